@@ -22,12 +22,26 @@ class xy_rect : public hittable {
             return true;
         }
 
+        virtual bool sample_surface(hit_record& rec, double& area) const override {
+            rec.u = random_double();
+            rec.v = random_double();
+            const double x = x0 + rec.u * (x1 - x0);
+            const double y = y0 + rec.v * (y1 - y0);
+            rec.p = point3(x, y, k);
+            rec.normal = vec3(0, 0, 1);
+            rec.front_face = true;
+            rec.mat_ptr = mp;
+            area = (x1 - x0) * (y1 - y0);
+            return true;
+        }
+
     public:
         shared_ptr<material> mp;
         double x0, x1, y0, y1, k;
 };
 
 bool xy_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    STAT_PRIMITIVE(PRIM_RECT);
     auto t = (k-r.origin().z()) / r.direction().z();
     if (t < t_min || t > t_max)
         return false;
@@ -37,6 +51,7 @@ bool xy_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
         return false;
     rec.u = (x-x0)/(x1-x0);
     rec.v = (y-y0)/(y1-y0);
+    rec.uv_scale = 1 / sqrt((x1-x0)*(y1-y0));
     rec.t = t;
     auto outward_normal = vec3(0, 0, 1);
     rec.set_face_normal(r, outward_normal);
@@ -62,6 +77,19 @@ class xz_rect : public hittable {
             return true;
         }
 
+        virtual bool sample_surface(hit_record& rec, double& area) const override {
+            rec.u = random_double();
+            rec.v = random_double();
+            const double x = x0 + rec.u * (x1 - x0);
+            const double z = z0 + rec.v * (z1 - z0);
+            rec.p = point3(x, k, z);
+            rec.normal = vec3(0, 1, 0);
+            rec.front_face = true;
+            rec.mat_ptr = mp;
+            area = (x1 - x0) * (z1 - z0);
+            return true;
+        }
+
     public:
         shared_ptr<material> mp;
         double x0, x1, z0, z1, k;
@@ -84,12 +112,26 @@ class yz_rect : public hittable {
             return true;
         }
 
+        virtual bool sample_surface(hit_record& rec, double& area) const override {
+            rec.u = random_double();
+            rec.v = random_double();
+            const double y = y0 + rec.u * (y1 - y0);
+            const double z = z0 + rec.v * (z1 - z0);
+            rec.p = point3(k, y, z);
+            rec.normal = vec3(1, 0, 0);
+            rec.front_face = true;
+            rec.mat_ptr = mp;
+            area = (y1 - y0) * (z1 - z0);
+            return true;
+        }
+
     public:
         shared_ptr<material> mp;
         double y0, y1, z0, z1, k;
 };
 
 bool xz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    STAT_PRIMITIVE(PRIM_RECT);
     auto t = (k-r.origin().y()) / r.direction().y();
     if (t < t_min || t > t_max)
         return false;
@@ -99,6 +141,7 @@ bool xz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
         return false;
     rec.u = (x-x0)/(x1-x0);
     rec.v = (z-z0)/(z1-z0);
+    rec.uv_scale = 1 / sqrt((x1-x0)*(z1-z0));
     rec.t = t;
     auto outward_normal = vec3(0, 1, 0);
     rec.set_face_normal(r, outward_normal);
@@ -108,6 +151,7 @@ bool xz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
 }
 
 bool yz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    STAT_PRIMITIVE(PRIM_RECT);
     auto t = (k-r.origin().x()) / r.direction().x();
     if (t < t_min || t > t_max)
         return false;
@@ -117,6 +161,7 @@ bool yz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
         return false;
     rec.u = (y-y0)/(y1-y0);
     rec.v = (z-z0)/(z1-z0);
+    rec.uv_scale = 1 / sqrt((y1-y0)*(z1-z0));
     rec.t = t;
     auto outward_normal = vec3(1, 0, 0);
     rec.set_face_normal(r, outward_normal);
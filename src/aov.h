@@ -0,0 +1,86 @@
+#ifndef AOV_H
+#define AOV_H
+
+#include "rtweekend.h"
+
+// Arbitrary output variables written next to the beauty pass.
+enum aov_plane {
+    AOV_DEPTH,      // distance along the camera ray to the first hit (rec.t)
+    AOV_NORMAL,     // shading normal at the first hit
+    AOV_ALBEDO,     // material color at the first hit
+    AOV_OBJECT_ID,  // top-level object index of the first hit, -1 for background
+    AOV_PATH_DEPTH, // number of bounces before the path terminated
+    AOV_COUNT
+};
+
+inline int aov_channels(int plane) {
+    return (plane == AOV_NORMAL || plane == AOV_ALBEDO) ? 3 : 1;
+}
+
+inline const char* aov_name(int plane) {
+    switch (plane) {
+        case AOV_DEPTH: return "depth";
+        case AOV_NORMAL: return "normal";
+        case AOV_ALBEDO: return "albedo";
+        case AOV_OBJECT_ID: return "object_id";
+        case AOV_PATH_DEPTH: return "path_depth";
+    }
+    return "unknown";
+}
+
+// Filled in by ray_color for a single camera sample.
+struct aov_sample {
+    bool hit = false;
+    double depth = 0;
+    vec3 normal;
+    color albedo;
+    int object_id = -1;
+    int path_depth = 0;
+};
+
+// Running per-pixel average of aov_samples.
+struct aov_accumulator {
+    void add(const aov_sample& s) {
+        samples++;
+        path_depth += s.path_depth;
+        if (!s.hit) return;
+
+        if (hits == 0) object_id = s.object_id;
+        hits++;
+        depth += s.depth;
+        normal += s.normal;
+        albedo += s.albedo;
+    }
+
+    // Writes the averaged value of the plane into out, aov_channels(plane) floats.
+    void resolve(int plane, float* out) const {
+        double inv_hits = hits > 0 ? 1.0 / hits : 0.0;
+        switch (plane) {
+            case AOV_DEPTH:
+                out[0] = static_cast<float>(depth * inv_hits);
+                break;
+            case AOV_NORMAL:
+                for (int c = 0; c < 3; c++) out[c] = static_cast<float>(normal[c] * inv_hits);
+                break;
+            case AOV_ALBEDO:
+                for (int c = 0; c < 3; c++) out[c] = static_cast<float>(albedo[c] * inv_hits);
+                break;
+            case AOV_OBJECT_ID:
+                out[0] = static_cast<float>(object_id);
+                break;
+            case AOV_PATH_DEPTH:
+                out[0] = samples > 0 ? static_cast<float>(double(path_depth) / samples) : 0.0f;
+                break;
+        }
+    }
+
+    int samples = 0;
+    int hits = 0;
+    double depth = 0;
+    vec3 normal;
+    color albedo;
+    int object_id = -1;
+    long path_depth = 0;
+};
+
+#endif
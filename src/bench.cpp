@@ -0,0 +1,291 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "aabb.h"
+#include "lens.h"
+#include "material.h"
+#include "presets.h"
+#include "scene.h"
+#include "sphere.h"
+#include "tile_scheduler.h"
+
+// Throughput benchmark over the built-in scenes plus microbenchmarks of the hot
+// intersection and scattering routines. Everything runs with fixed seeds, sizes and
+// sample counts and is reported as JSON, so runs can be compared across commits:
+//     ./bench.exe --out bench.json
+
+using bench_clock = std::chrono::steady_clock;
+
+double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+long peak_memory_kb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Counts every ray traced against the wrapped world, one counter per thread.
+class counting_hittable : public hittable {
+    public:
+        counting_hittable(const hittable& w) : world(w) {}
+
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+            rays()++;
+            return world.hit(r, t_min, t_max, rec);
+        }
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+            return world.bounding_box(time0, time1, output_box);
+        }
+
+        static uint64_t& rays() {
+            thread_local uint64_t count = 0;
+            return count;
+        }
+
+    private:
+        const hittable& world;
+};
+
+struct bench_settings {
+    int width = 160;
+    int height = 160;
+    int samples_per_pixel = 8;
+    int max_depth = 10;
+    uint64_t seed = 1;
+    unsigned max_threads = default_thread_count();
+    long micro_iterations = 2000000;
+};
+
+struct scene_result {
+    unsigned threads;
+    double seconds;
+    uint64_t primary_rays;
+    uint64_t total_rays;
+};
+
+scene_result render_scene(const scene& world, const scene_preset& preset, const bench_settings& settings, unsigned threads) {
+    tile_scheduler scheduler(threads);
+    scheduler.add_frame(settings.width, settings.height, 16, ORDER_HILBERT);
+
+    const camera cam = preset.make_camera(double(settings.width) / settings.height);
+    const counting_hittable counted(world.root());
+    std::vector<uint64_t> rays(threads, 0);
+
+    auto start = bench_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threads; i++) {
+        workers.emplace_back([&, i] {
+            counting_hittable::rays() = 0;
+            tile t;
+            while (scheduler.next(i, t)) {
+                for (int y = t.y0; y < t.y1; y++)
+                for (int x = t.x0; x < t.x1; x++) {
+                    render_pixel(cam, x, y, settings.width, settings.height, settings.samples_per_pixel,
+                        counted, settings.max_depth, preset.background, settings.seed);
+                }
+            }
+            rays[i] = counting_hittable::rays();
+        });
+    }
+    for (auto& w : workers) w.join();
+
+    scene_result result;
+    result.threads = threads;
+    result.seconds = seconds_since(start);
+    result.primary_rays = static_cast<uint64_t>(settings.width) * settings.height * settings.samples_per_pixel;
+    result.total_rays = 0;
+    for (auto r : rays) result.total_rays += r;
+    return result;
+}
+
+std::vector<unsigned> thread_counts(unsigned max_threads) {
+    std::vector<unsigned> counts;
+    for (unsigned t = 1; t < max_threads; t *= 2) counts.push_back(t);
+    counts.push_back(max_threads);
+    return counts;
+}
+
+bool bench_scene(const std::string& name, const bench_settings& settings, std::ostream& json) {
+    seed_random(settings.seed);
+
+    // building the scene includes the BVHs its objects make for themselves
+    auto build_start = bench_clock::now();
+    scene_preset preset;
+    if (!load_preset(name, 1.0, preset)) {
+        std::cerr << "unknown scene " << name << "\n";
+        return false;
+    }
+    auto world = scene_builder(preset.objects).commit(preset.time0, preset.time1);
+    const double build_ms = seconds_since(build_start) * 1000.0;
+
+    json << "    {\n"
+         << "      \"scene\": \"" << name << "\",\n"
+         << "      \"objects\": " << world->objects().size() << ",\n"
+         << "      \"build_ms\": " << build_ms << ",\n"
+         << "      \"runs\": [\n";
+
+    auto counts = thread_counts(settings.max_threads);
+    for (size_t i = 0; i < counts.size(); i++) {
+        scene_result r = render_scene(*world, preset, settings, counts[i]);
+        std::cerr << name << " threads=" << r.threads << " " << r.total_rays / r.seconds / 1e6 << " Mrays/s\n";
+
+        json << "        {\"threads\": " << r.threads
+             << ", \"seconds\": " << r.seconds
+             << ", \"primary_rays\": " << r.primary_rays
+             << ", \"total_rays\": " << r.total_rays
+             << ", \"primary_rays_per_sec\": " << r.primary_rays / r.seconds
+             << ", \"total_rays_per_sec\": " << r.total_rays / r.seconds
+             << ", \"ns_per_ray\": " << r.seconds * 1e9 / std::max<uint64_t>(r.total_rays, 1)
+             << "}" << (i + 1 < counts.size() ? "," : "") << "\n";
+    }
+
+    json << "      ]\n"
+         << "    }";
+    return true;
+}
+
+// Random rays starting outside a unit sphere around the origin and pointing roughly at it.
+std::vector<ray> make_rays(size_t n) {
+    std::vector<ray> rays;
+    rays.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        point3 origin = 4.0 * random_unit_vector();
+        point3 target = 1.2 * random_in_unit_sphere();
+        rays.emplace_back(origin, target - origin);
+    }
+    return rays;
+}
+
+template<typename F>
+double time_ns_per_op(long iterations, F f) {
+    auto start = bench_clock::now();
+    for (long i = 0; i < iterations; i++) f(i);
+    return seconds_since(start) * 1e9 / iterations;
+}
+
+void bench_micro(const bench_settings& settings, std::ostream& json) {
+    seed_random(settings.seed);
+    const std::vector<ray> rays = make_rays(4096);
+    const size_t mask = rays.size() - 1;
+    const long n = settings.micro_iterations;
+    long sink = 0;
+
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    sphere sph(point3(0,0,0), 1.0, mat);
+    lens lns(point3(0,0,0), point3(0,0,1), 1.0, 0.5, mat);
+    aabb box(point3(-1,-1,-1), point3(1,1,1));
+
+    std::vector<std::pair<std::string, double>> results;
+
+    results.emplace_back("sphere::hit", time_ns_per_op(n, [&](long i) {
+        hit_record rec;
+        sink += sph.hit(rays[i & mask], 0.001, infinity, rec);
+    }));
+    results.emplace_back("aabb::hit", time_ns_per_op(n, [&](long i) {
+        sink += box.hit(rays[i & mask], 0.001, infinity);
+    }));
+    results.emplace_back("lens::hit", time_ns_per_op(n, [&](long i) {
+        hit_record rec;
+        sink += lns.hit(rays[i & mask], 0.001, infinity, rec);
+    }));
+
+    // scatter is measured on precomputed sphere hits
+    std::vector<hit_record> hits;
+    for (const auto& r : rays) {
+        hit_record rec;
+        if (sph.hit(r, 0.001, infinity, rec)) hits.push_back(rec);
+    }
+    const size_t hit_count = hits.size();
+
+    std::vector<std::pair<std::string, shared_ptr<material>>> materials = {
+        {"lambertian::scatter", make_shared<lambertian>(color(0.5, 0.5, 0.5))},
+        {"metal::scatter", make_shared<metal>(color(0.8, 0.8, 0.8), 0.3)},
+        {"dielectric::scatter", make_shared<dielectric>(1.5)},
+        {"diffuse_light::scatter", make_shared<diffuse_light>(color(4, 4, 4))},
+        {"isotropic::scatter", make_shared<isotropic>(color(0.5, 0.5, 0.5))},
+    };
+    for (const auto& m : materials) {
+        results.emplace_back(m.first, time_ns_per_op(n, [&](long i) {
+            const hit_record& rec = hits[i % hit_count];
+            color attenuation;
+            ray scattered;
+            sink += m.second->scatter(rays[i & mask], rec, attenuation, scattered);
+        }));
+    }
+
+    json << "  \"micro_ns_per_op\": {\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        std::cerr << results[i].first << " " << results[i].second << " ns\n";
+        json << "    \"" << results[i].first << "\": " << results[i].second << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    json << "  },\n"
+         << "  \"micro_checksum\": " << sink << ",\n";
+}
+
+int main(int argc, char **argv) {
+    bench_settings settings;
+    std::string out_path;
+    std::vector<std::string> scenes = {"random_scene", "final_scene", "lens_showcase", "di_test"};
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--quick") {
+            settings.width = settings.height = 64;
+            settings.samples_per_pixel = 2;
+            settings.micro_iterations = 200000;
+        } else if (i + 1 < argc && arg == "--threads") {
+            settings.max_threads = std::max(1, std::atoi(argv[++i]));
+        } else if (i + 1 < argc && arg == "--out") {
+            out_path = argv[++i];
+        } else if (i + 1 < argc && arg == "--scene") {
+            scenes = {argv[++i]};
+            const auto names = preset_names();
+            if (std::find(names.begin(), names.end(), scenes[0]) == names.end()) {
+                std::cerr << "unknown scene " << scenes[0] << "\n";
+                return 1;
+            }
+        } else {
+            std::cerr << "usage: bench.exe [--quick] [--threads n] [--scene name] [--out file.json]\n";
+            return 1;
+        }
+    }
+
+    std::ostringstream json;
+    json << "{\n"
+         << "  \"width\": " << settings.width << ",\n"
+         << "  \"height\": " << settings.height << ",\n"
+         << "  \"samples_per_pixel\": " << settings.samples_per_pixel << ",\n"
+         << "  \"max_depth\": " << settings.max_depth << ",\n"
+         << "  \"seed\": " << settings.seed << ",\n";
+
+    bench_micro(settings, json);
+
+    json << "  \"scenes\": [\n";
+    for (size_t i = 0; i < scenes.size(); i++) {
+        if (!bench_scene(scenes[i], settings, json)) return 1;
+        json << (i + 1 < scenes.size() ? ",\n" : "\n");
+    }
+    // the peak of the whole process, scenes only ever add to it
+    json << "  ],\n"
+         << "  \"peak_memory_kb\": " << peak_memory_kb() << "\n"
+         << "}\n";
+
+    if (out_path.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream(out_path) << json.str();
+    }
+    return 0;
+}
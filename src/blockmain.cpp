@@ -1,14 +1,20 @@
 #include <atomic>
 #include <cfloat>
+#include <condition_variable>
 #include <cstdlib>
 #include <iostream>
 #include <mutex>
 #include <thread>
 #include <vector>
 #include <cmath>
+#include <chrono>
 #include <fstream>
+#include <string>
 
+#include "aov.h"
 #include "camera.h"
+#include "lens_camera.h"
+#include "checkpoint.h"
 #include "color.h"
 #include "hittable_list.h"
 #include "sphere.h"
@@ -16,17 +22,22 @@
 #include "aarect.h"
 #include "box.h"
 #include "constant_medium.h"
+#include "framebuffer.h"
+#include "frustum.h"
+#include "presets.h"
 #include "render.h"
+#include "tile_scheduler.h"
+#include "trace.h"
 
 //defining global consts
 
-const auto aspect_ratio = 1.0 / 1.0;
-const int image_width = 1024;
-const int image_height = static_cast<int>(image_width / aspect_ratio);
-const int samples_per_pixel = 100;
+int image_width = 1024;  // set with --width
+int image_height = 1024; // set with --height
+int samples_per_pixel = 100;
 const int max_depth = 10;
 color background(1,1,1);
 
+// the view of di_test, replaced by the preset's with --scene
 point3 lookfrom = point3(-2, 1, -4);
 point3 lookat = point3(0, 1, -7);
 vec3 vup(0,1,0);
@@ -34,174 +45,494 @@ auto dist_to_focus = (lookfrom - lookat).length();
 auto aperture = 0.0;
 auto vfov = 40.0;
 
-auto cam = camera(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus);
-auto world = di_test(0);
+// made in main, a lens_camera with --lens-file
+shared_ptr<camera> cam;
+shared_ptr<const scene> world; // built in main, so a trace can include it
 
 int image_num = 10;
-int thread_num = 6;
+unsigned thread_num = default_thread_count();
+
+// trace 4 wavelengths per path instead of rgb, set with --spectral
+bool spectral = false;
+
+// caustic photons shot per pass, set with --photons, 0 to path trace only. The search
+// radius shrinks from photon_radius with every pass.
+int photon_count = 0;
+double photon_radius = 0.05;
+std::vector<shared_ptr<hittable>> emitters;
+photon_map caustics;
+
+// learn where light comes from and steer diffuse bounces there, set with --guide. The
+// guide is refined between passes.
+bool guiding = false;
+std::unique_ptr<sd_tree> guide;
+
+// light the scene with an environment map instead of the white background, set with --env
+environment_map environment;
+
+// reuse diffuse lighting between nearby points, set with --irradiance-cache
+bool caching = false;
+std::unique_ptr<irradiance_cache> cache;
+
+// also write depth, normal, albedo, object id and path depth planes next to the image,
+// set with --aovs
+bool write_aovs = false;
+
+// with RT_STATS, also write the average traversal cost per sample as block_cost.pfm
+const bool write_cost_map = stats_enabled;
+
+const int tile_size = 32;
+const tile_order order = ORDER_SNAKE;
+
+// fill tiles whose camera rays can't hit anything with the background, and trace the
+// camera rays of tiles that see only a few objects against just those. --no-cull turns
+// it off.
+bool culling = true;
+const size_t tile_candidate_limit = 8;
+
+// What the camera rays of a tile can hit.
+enum tile_view {
+    VIEW_EMPTY,   // nothing, they all see the background
+    VIEW_REDUCED, // only the candidates
+    VIEW_FULL     // anything
+};
 
-constexpr unsigned N = 32;
+// samples are added in passes over the whole image, so a checkpoint never lags far behind
+const int samples_per_pass = 8;
+std::string checkpoint_path = "./output/block.ckpt";
+double checkpoint_interval = 60.0; // seconds
+const uint64_t seed = 0;
 
-constexpr unsigned W_CNT = (image_width + N - 1) / N;
-constexpr unsigned H_CNT = (image_height + N - 1) / N;
+tile_scheduler scheduler{thread_num};
 
-std::atomic<unsigned> done_count;
+// workers that finished the current pass, main waits on pass_done for all of them
+std::mutex done_mutex;
+std::condition_variable pass_done;
+unsigned done_count;
 
-struct Pixels {
-    Pixels(unsigned w, unsigned h)
-        : width{w},
-                height{h},
-                data{new float[width * height * 5]()},       // RGBA + sample count
-                pixels{new uint8_t[width * height * 4]()}  // RGBA
-    {}
+// held while a finished tile is added to pixels, and while a checkpoint copies them
+std::mutex commit_mutex;
 
-    ~Pixels() {
-        delete[] data;
-        delete[] pixels;
-    }
-
-    uint8_t *get_pixels() {
-        // convert accumulated pixels values so we can display them
-        for (int i = 0; i < image_height; i++)
-        for (int j = 0; j < image_width; j++) {
-            const unsigned data_pos = (i * width + j) * 3;
-
-            auto r = data[data_pos + 0];
-            auto g = data[data_pos + 1];
-            auto b = data[data_pos + 2];
-        
-            auto scale = 1.0 / samples_per_pixel;
-            r = sqrt(scale * r);
-            g = sqrt(scale * g);
-            b = sqrt(scale * b);
-
-            pixels[data_pos + 0] = static_cast<int>(256 * clamp(r, 0.0, 0.999));
-            pixels[data_pos + 1] = static_cast<int>(256 * clamp(g, 0.0, 0.999));
-            pixels[data_pos + 2] = static_cast<int>(256 * clamp(b, 0.0, 0.999));
-        }
+struct Pixels {
+    Pixels() {
+        for (int p = 0; p < AOV_COUNT; p++) aovs[p] = nullptr;
+    }
 
-        return pixels;
+    // sizes the image once the command line is read, before any aov plane is enabled
+    void allocate(unsigned w, unsigned h) {
+        width = w;
+        height = h;
+        beauty = framebuffer(static_cast<int>(w), static_cast<int>(h));
+        if (write_cost_map) cost.assign(width * height, 0.0f);
     }
 
-    inline void accumulate(unsigned x, unsigned y, float r, float g, float b) {
-        const unsigned pos = (y * width + x) * 3;
-        data[pos + 0] = r;
-        data[pos + 1] = g;
-        data[pos + 2] = b;
+    // allocates the aov planes, which are left out until asked for
+    void enable_aovs() {
+        for (int p = 0; p < AOV_COUNT; p++) {
+            if (!aovs[p]) aovs[p] = new float[width * height * aov_channels(p)]();
+        }
     }
 
-    inline void accumulate(unsigned x, unsigned y, const vec3 &col) {
-        accumulate(x, y, col.x(), col.y(), col.z());
+    ~Pixels() {
+        for (int p = 0; p < AOV_COUNT; p++) delete[] aovs[p];
     }
 
-    unsigned width;
-    unsigned height;
-    float *data;  // RGBA + sample count
+    inline void accumulate(unsigned x, unsigned y, const vec3 &col, int count) {
+        beauty.add(x, y, col, count);
+    }
 
-    private:
-        uint8_t *pixels;  // RGBA
+    inline int sample_count(unsigned x, unsigned y) const {
+        return static_cast<int>(beauty.samples[y * width + x]);
+    }
 
-} pixels{image_width, image_height};
+    checkpoint make_checkpoint() const {
+        checkpoint ck;
+        ck.seed = seed;
+        ck.beauty = beauty;
+        for (int p = 0; p < AOV_COUNT; p++) {
+            if (!aovs[p]) continue;
+            ck.plane_channels.push_back(aov_channels(p));
+            ck.planes.emplace_back(aovs[p], aovs[p] + width * height * aov_channels(p));
+        }
+        return ck;
+    }
 
-struct Task {
-    Task() : my_id{id++} {}
+    bool restore(const checkpoint &ck) {
+        if (ck.beauty.width != static_cast<int>(width) || ck.beauty.height != static_cast<int>(height) || ck.seed != seed) return false;
+        beauty = ck.beauty;
+        size_t next_plane = 0;
+        for (int p = 0; p < AOV_COUNT; p++) {
+            if (!aovs[p] || next_plane >= ck.planes.size()) continue;
+            const auto &plane = ck.planes[next_plane++];
+            if (plane.size() == width * height * aov_channels(p)) std::copy(plane.begin(), plane.end(), aovs[p]);
+        }
+        return true;
+    }
 
-    Task(int x, int y) : sx{x}, sy{y}, my_id{id++} {}
+    inline void accumulate_aov(unsigned x, unsigned y, const aov_accumulator &acc) {
+        for (int p = 0; p < AOV_COUNT; p++) {
+            if (!aovs[p]) continue;
+            const unsigned c = aov_channels(p);
+            acc.resolve(p, &aovs[p][(y * width + x) * c]);
+        }
+    }
 
-    void move_in_pattern(int &rx, int &ry) {
-        // snake pattern implementation
-        static int x = -1, y = H_CNT - 1;
-        static int dir = 0;
+    inline void accumulate_cost(unsigned x, unsigned y, uint64_t c) {
+        if (write_cost_map) cost[y * width + x] += static_cast<float>(c);
+    }
 
-        x = dir ? x - 1 : x + 1;
-        if (x == W_CNT || x == -1) {
-            x = y & 1 ? W_CNT - 1 : 0;
-            y--;
-            dir = !dir;
+    void write_cost(const std::string &path) const {
+        std::vector<float> average(cost.size());
+        for (size_t i = 0; i < cost.size(); i++) {
+            average[i] = beauty.samples[i] > 0 ? cost[i] / beauty.samples[i] : 0.0f;
         }
-        rx = x;
-        ry = y;
-    }
-
-    bool get_next_task() {
-        static bool taken[H_CNT][W_CNT] = {};
-        static std::mutex m;
-
-        std::lock_guard<std::mutex> guard{m};
-
-        bool found = false;
-        int x, y, i;
-        i = 0;
-        while (!found) {
-            i++;
-            move_in_pattern(x, y);
-            if (x < 0 || x > W_CNT || y < 0 || y > H_CNT) break;
-
-            if (!taken[y][x]) {
-                sx = x * N;
-                sy = y * N;
-                taken[y][x] = true;
-                found = true;
-                //std::cout << "found task after : " << i << " searches" << std::endl;
-            }
+        write_pfm(path, average.data(), width, height, 1);
+    }
+
+    void write_aov_planes(const std::string &prefix) const {
+        for (int p = 0; p < AOV_COUNT; p++) {
+            if (!aovs[p]) continue;
+            write_pfm(prefix + "_" + aov_name(p) + ".pfm", aovs[p], width, height, aov_channels(p));
         }
-        return found;
     }
 
+    unsigned width = 0;
+    unsigned height = 0;
+    framebuffer beauty;
+    float *aovs[AOV_COUNT];  // one float plane per aov, nullptr when disabled
+    std::vector<float> cost; // summed traversal cost, empty unless write_cost_map
+} pixels;
+
+tile_view cull_tile(const tile &t, hittable_list &candidates) {
+    // an environment map isn't a single colour, and spectral samples only see the
+    // background through a random wavelength, so neither has a shortcut
+    if (!culling || environment.loaded() || spectral) return VIEW_FULL;
+
+    // widened a little, since u and v are rounded to float
+    const double pad = 1e-4;
+    point3 apex;
+    vec3 corner[4];
+    if (!cam->ray_pyramid(double(t.x0) / image_width - pad, double(t.x1) / image_width + pad,
+                          double(t.y0) / image_height - pad, double(t.y1) / image_height + pad, apex, corner)) {
+        return VIEW_FULL;
+    }
+
+    std::vector<shared_ptr<hittable>> found;
+    if (!frustum_candidates(world->root(), frustum(apex, corner), world->time0(), world->time1(), tile_candidate_limit, found)) {
+        return VIEW_FULL;
+    }
+    if (found.empty()) return VIEW_EMPTY;
+    candidates.objects = std::move(found);
+    return VIEW_REDUCED;
+}
+
+struct Task {
+    Task(int id, int target) : my_id{id}, pass_target{target} {}
+
     void operator()() {
-        bool done = false;
-        do {
-            if (!get_next_task()) {
-                done = true;
-                continue;
+        tile t;
+        std::vector<color> cols;
+        std::vector<int> counts;
+        std::vector<aov_accumulator> accs;
+        std::vector<uint64_t> costs;
+        hittable_list candidates;
+        trace_thread_name("worker " + std::to_string(my_id));
+
+        while (true) {
+            {
+                trace_span span("scheduler wait", "scheduler");
+                if (!scheduler.next(my_id, t)) break;
             }
-            
-            for (unsigned y = sy; y < sy + N; y++)
-            for (unsigned x = sx; x < sx + N; x++) {
-                if (x < 0 || y < 0 || x >= image_width || y >= image_height) continue;
+            trace_span tile_span("tile", "render", pass_target, t.x0, t.y0);
+            cols.clear();
+            counts.clear();
+            accs.clear();
+            costs.clear();
+            candidates.clear();
+            const tile_view view = cull_tile(t, candidates);
+            const hittable *primary = view == VIEW_REDUCED ? &candidates : nullptr;
+
+            for (int y = t.y0; y < t.y1; y++)
+            for (int x = t.x0; x < t.x1; x++) {
+                // continue from the pixel's own count, which may come from a checkpoint
+                const int first = pixels.sample_count(x, y);
                 color col = color(0,0,0);
-                for (unsigned s = 0; s < samples_per_pixel; s++) {
-                    const float u = float(x + random_double()) / float(image_width);
-                    const float v = float(y + random_double()) / float(image_height);
-                    ray r = cam.get_ray(u, v);
-                    col += ray_color(r, background, world, max_depth);
+                aov_accumulator acc;
+                const uint64_t cost_before = STAT_COST();
+                if (view == VIEW_EMPTY) {
+                    const int n = std::max(pass_target - first, 0);
+                    col = n * background;
+                    if (write_aovs && first == 0) {
+                        for (int s = 0; s < n; s++) acc.add(aov_sample());
+                    }
+                } else {
+                    for (int s = first; s < pass_target; s++) {
+                        seed_sample(seed, x, y, s);
+                        const float u = float(x + random_double()) / float(image_width);
+                        const float v = float(y + random_double()) / float(image_height);
+                        ray r = cam->get_ray(u, v);
+                        r.spread = cam->pixel_spread(image_height);
+                        STAT_RAY(RAY_PRIMARY);
+                        // aovs are taken from the first pass over a pixel
+                        if (write_aovs && first == 0) {
+                            aov_sample aov;
+                            col += trace(r, &aov, primary);
+                            acc.add(aov);
+                        } else {
+                            col += trace(r, nullptr, primary);
+                        }
+                    }
                 }
-                pixels.accumulate(x, y, col);
+                cols.push_back(col);
+                counts.push_back(std::max(pass_target - first, 0));
+                accs.push_back(acc);
+                costs.push_back(STAT_COST() - cost_before);
+            }
+
+            std::unique_lock<std::mutex> guard{commit_mutex, std::defer_lock};
+            {
+                trace_span span("commit wait", "scheduler");
+                guard.lock();
+            }
+            size_t i = 0;
+            for (int y = t.y0; y < t.y1; y++)
+            for (int x = t.x0; x < t.x1; x++, i++) {
+                if (counts[i] == 0) continue;
+                if (write_aovs && accs[i].samples > 0) pixels.accumulate_aov(x, y, accs[i]);
+                pixels.accumulate(x, y, cols[i], counts[i]);
+                pixels.accumulate_cost(x, y, costs[i]);
             }
-        } while (!done);
+        }
 
+        std::lock_guard<std::mutex> guard{done_mutex};
         done_count++;
+        pass_done.notify_one();
+    }
 
-        std::cout << "Thread " << my_id << " is done!" << std::endl;
+    // at most one integrator is enabled, see main. primary narrows down what r itself can
+    // hit, where the integrator supports it
+    color trace(const ray &r, aov_sample *aov, const hittable *primary) const {
+        if (photon_count > 0) return ray_color_photons(r, background, world->root(), max_depth, caustics, aov);
+        if (environment.loaded()) return ray_color_env(r, environment, world->root(), max_depth, aov);
+        if (cache) return ray_color_cached(r, background, world->root(), max_depth, *cache, aov);
+        if (guide) return ray_color_guided(r, background, world->root(), max_depth, *guide, 0.5, aov);
+        if (spectral) return ray_color_spectral(r, background, world->root(), max_depth, aov);
+        return ray_color(r, background, world->root(), max_depth, aov, primary);
     }
 
-    int sx = -1, sy = -1;
     int my_id;
-    static int id;
+    int pass_target;
 };
 
-int Task::id = 0;
+void save_progress() {
+    trace_span span("checkpoint", "io");
+    checkpoint ck;
+    {
+        std::lock_guard<std::mutex> guard{commit_mutex};
+        ck = pixels.make_checkpoint();
+    }
+    if (!save_checkpoint(checkpoint_path, ck)) {
+        std::cerr << "Could not write checkpoint " << checkpoint_path << std::endl;
+    }
+}
+
+// Mean squared error of the finished image against a reference of the same size, read
+// from a pfm, or -1 when the reference can't be used.
+double reference_error(const std::string &path) {
+    int width, height;
+    std::vector<float> rgb;
+    if (!read_pfm(path, width, height, rgb) || width != image_width || height != image_height) return -1;
+
+    const std::vector<float> scale = pixels.beauty.sample_scale();
+    double sum = 0;
+    for (int y = 0; y < image_height; y++)
+    for (int x = 0; x < image_width; x++) {
+        // the reference's rows go top down, the framebuffer's bottom up
+        const size_t pos = static_cast<size_t>(y) * image_width + x;
+        const size_t ref = (static_cast<size_t>(image_height - 1 - y) * image_width + x) * 3;
+        for (int c = 0; c < 3; c++) {
+            const double d = pixels.beauty.rgb[pos * 3 + c] * scale[pos] - rgb[ref + c];
+            sum += d * d;
+        }
+    }
+    return sum / (3.0 * image_width * image_height);
+}
+
+void usage() {
+    std::cerr << "usage: block [--scene name] [--width w] [--height h] [--resume] [--checkpoint path] [--checkpoint-interval seconds] [--spp n] [--trace file.json] [--lens-file path] [--focus distance] [--spectral | --photons n [--photon-radius r] | --guide | --irradiance-cache | --env file.pfm|file.hdr] [--no-cull] [--aovs] [--format ppm|ppm16|pfm|exr|qoi] [--reference file.pfm]" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    bool resume = false;
+    std::string scene_name; // di_test seen from block's own view when empty
+    std::string lens_file;
+    double lens_focus = 0; // 0 focuses on lookat
+    std::string env_file;
+    image_format format = FORMAT_PPM;
+    std::string reference_file;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--resume") resume = true;
+        else if (arg == "--scene" && i + 1 < argc) scene_name = argv[++i];
+        else if (arg == "--width" && i + 1 < argc) image_width = std::atoi(argv[++i]);
+        else if (arg == "--height" && i + 1 < argc) image_height = std::atoi(argv[++i]);
+        else if (arg == "--format" && i + 1 < argc && parse_format(argv[i + 1], format)) i++;
+        else if (arg == "--reference" && i + 1 < argc) reference_file = argv[++i];
+        else if (arg == "--checkpoint" && i + 1 < argc) checkpoint_path = argv[++i];
+        else if (arg == "--checkpoint-interval" && i + 1 < argc) checkpoint_interval = std::atof(argv[++i]);
+        else if (arg == "--spp" && i + 1 < argc) samples_per_pixel = std::atoi(argv[++i]);
+        else if (arg == "--trace" && i + 1 < argc) trace_begin(argv[++i]);
+        else if (arg == "--lens-file" && i + 1 < argc) lens_file = argv[++i];
+        else if (arg == "--focus" && i + 1 < argc) lens_focus = std::atof(argv[++i]);
+        else if (arg == "--spectral") spectral = true;
+        else if (arg == "--photons" && i + 1 < argc) photon_count = std::atoi(argv[++i]);
+        else if (arg == "--photon-radius" && i + 1 < argc) photon_radius = std::atof(argv[++i]);
+        else if (arg == "--guide") guiding = true;
+        else if (arg == "--irradiance-cache") caching = true;
+        else if (arg == "--env" && i + 1 < argc) env_file = argv[++i];
+        else if (arg == "--no-cull") culling = false;
+        else if (arg == "--aovs") write_aovs = true;
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (image_width < 1 || image_height < 1) {
+        usage();
+        return 1;
+    }
+
+    // each of these renders with its own integrator, which can't be combined
+    if ((photon_count > 0) + !env_file.empty() + caching + guiding + spectral > 1) {
+        std::cerr << "--spectral, --photons, --guide, --irradiance-cache and --env can't be combined" << std::endl;
+        usage();
+        return 1;
+    }
+
+    const double aspect_ratio = double(image_width) / image_height;
+    hittable_list objects;
+    if (scene_name.empty()) {
+        // with photons, light the scene with an emitter instead of the white background
+        objects = di_test(1.0, photon_count > 0);
+        if (photon_count > 0) background = color(0.05, 0.05, 0.05);
+        cam = make_shared<camera>(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus);
+    } else {
+        scene_preset preset;
+        seed_random(seed);
+        if (!load_preset(scene_name, 1.0, preset)) {
+            std::cerr << "unknown scene " << scene_name << std::endl;
+            return 1;
+        }
+        objects = preset.objects;
+        background = preset.background;
+        lookfrom = preset.lookfrom;
+        lookat = preset.lookat;
+        vup = preset.vup;
+        cam = make_shared<camera>(preset.make_camera(aspect_ratio));
+    }
+    if (photon_count > 0) {
+        emitters = find_emitters(objects);
+        if (emitters.empty()) {
+            std::cerr << "--photons needs a scene with lights" << std::endl;
+            return 1;
+        }
+    }
+
+    if (!lens_file.empty()) {
+        std::vector<lens_element> prescription;
+        if (!load_lens_prescription(lens_file, prescription)) return 1;
+        if (lens_focus <= 0) lens_focus = (lookfrom - lookat).length();
+        auto lc = make_shared<lens_camera>(lookfrom, lookat, vup, prescription, aspect_ratio, lens_focus);
+        std::cout << "Lens focal length " << lc->effective_focal_length() << " mm" << std::endl;
+        cam = lc;
+    }
+
+    if (!env_file.empty() && !environment.load(env_file)) return 1;
+    pixels.allocate(image_width, image_height);
+    if (write_aovs) pixels.enable_aovs();
+
+    trace_thread_name("main");
+    world = scene_builder(objects).commit(cam->time0(), cam->time1());
+    if (guiding) {
+        aabb bounds;
+        world->root().bounding_box(0, 0, bounds);
+        guide.reset(new sd_tree(bounds));
+    }
+    if (caching) {
+        aabb bounds;
+        world->root().bounding_box(0, 0, bounds);
+        cache.reset(new irradiance_cache(bounds, 0.02, 10.0));
+    }
+
+    if (resume) {
+        checkpoint ck;
+        if (!load_checkpoint(checkpoint_path, ck) || !pixels.restore(ck)) {
+            std::cerr << "Could not resume from " << checkpoint_path << std::endl;
+            return 1;
+        }
+        std::cout << "Resuming from " << checkpoint_path << std::endl;
+    }
 
-int main() {
     const unsigned int n_threads = thread_num;
     std::cout << "Detected " << n_threads << " concurrent threads." << std::endl;
-    std::vector<std::thread> threads{n_threads};
 
-    for (auto &t : threads) t = std::thread{Task{}};
+    const auto start = std::chrono::steady_clock::now();
+    auto last_checkpoint = start;
+    // capped so the time points can't overflow
+    const auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(std::min(checkpoint_interval, 1e9)));
+    for (int pass = 0; pass * samples_per_pass < samples_per_pixel; pass++) {
+        const int target = std::min((pass + 1) * samples_per_pass, samples_per_pixel);
+        if (photon_count > 0) {
+            caustics.build(world->root(), emitters, photon_count, progressive_radius(photon_radius, pass), seed, pass, n_threads);
+        }
+        scheduler.add_frame(image_width, image_height, tile_size, order, pass);
+
+        done_count = 0;
+        std::vector<std::thread> threads;
+        for (unsigned i = 0; i < n_threads; i++) threads.emplace_back(Task{static_cast<int>(i), target});
+
+        // wakes up when the pass is done, or to save a checkpoint while it runs
+        std::unique_lock<std::mutex> lock{done_mutex};
+        while (!pass_done.wait_until(lock, last_checkpoint + interval, [&] { return done_count == n_threads; })) {
+            lock.unlock();
+            save_progress();
+            last_checkpoint = std::chrono::steady_clock::now();
+            lock.lock();
+        }
+        lock.unlock();
+        for (auto &t : threads) t.join();
+        if (guide) guide->refine();
+
+        std::cout << "\rSamples done: " << target << "/" << samples_per_pixel << std::flush;
+    }
+    std::cout << std::endl;
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Rendered in " << seconds << " s" << std::endl;
 
-    std::cout << "Waiting for all the threads to join." << std::endl;
-    for (auto &t : threads) t.join();
+    // a finished render keeps its checkpoint, so more samples can be added later with --resume --spp
+    save_progress();
 
-    auto image = pixels.get_pixels();
+    {
+        trace_span span("encode", "io");
+        write_image(std::string("./output/block") + image_extension(format), pixels.beauty, format);
+        if (write_aovs) pixels.write_aov_planes("./output/block");
+    }
+
+    if (stats_enabled) print_stats(std::cout, stats_total());
+    if (write_cost_map) pixels.write_cost("./output/block_cost.pfm");
 
-    std::ofstream ofs("./output/block.ppm", std::ios::out | std::ios::binary);
-    ofs << "P6\n" << image_width << " " << image_height << "\n255\n";
-    for (unsigned i = 0; i < image_width * image_height; ++i) {
-        ofs << image[i*3+0] <<
-               image[i*3+1] <<
-               image[i*3+2];
+    if (!reference_file.empty()) {
+        const double mse = reference_error(reference_file);
+        if (mse < 0) {
+            std::cerr << "Could not compare with " << reference_file << std::endl;
+            return 1;
+        }
+        std::cout << "MSE against " << reference_file << ": " << mse << std::endl;
     }
-    ofs.close();
+
+    if (!trace_end()) std::cerr << "Could not write the trace" << std::endl;
 
     return 0;
 }
\ No newline at end of file
@@ -17,7 +17,9 @@
 #include "aarect.h"
 #include "box.h"
 #include "constant_medium.h"
+#include "framebuffer.h"
 #include "render.h"
+#include "tile_scheduler.h"
 
 //defining global consts
 
@@ -28,7 +30,7 @@ const int samples_per_pixel = 10000;
 const int max_depth = 50;
 color background(0,0,0);
 
-auto world = final_scene();
+const auto world = scene_builder(final_scene()).commit();
 
 point3 lookfrom = point3(478, 278, -600);
 point3 lookat = point3(278, 278, 0);
@@ -38,12 +40,12 @@ auto aperture = 0.0;
 auto vfov = 40.0;
 
 int image_num = 10;
-int thread_num = 2;
+unsigned thread_num = default_thread_count();
 
-constexpr unsigned N = 64;
+const int tile_size = 64;
+const tile_order order = ORDER_SNAKE;
 
-constexpr unsigned W_CNT = (image_width + N - 1) / N;
-constexpr unsigned H_CNT = (image_height + N - 1) / N;
+tile_scheduler scheduler{thread_num};
 
 std::atomic<unsigned> done_count;
 
@@ -51,130 +53,57 @@ struct Pixels {
     Pixels(unsigned w, unsigned h)
         : width{w},
                 height{h},
-                data{new float[width * height * 5]()},       // RGBA + sample count
-                pixels{new uint8_t[width * height * 4]()}  // RGBA
+                beauty{static_cast<int>(w), static_cast<int>(h)}
     {}
 
-    ~Pixels() {
-        delete[] data;
-        delete[] pixels;
-    }
-
     uint8_t *get_pixels() {
         // convert accumulated pixels values so we can display them
-        for (int i = 0; i < image_height; i++)
-        for (int j = 0; j < image_width; j++) {
-            const unsigned data_pos = (i * width + j) * 3;
-
-            auto r = data[data_pos + 0];
-            auto g = data[data_pos + 1];
-            auto b = data[data_pos + 2];
-        
-            auto scale = 1.0 / samples_per_pixel;
-            r = sqrt(scale * r);
-            g = sqrt(scale * g);
-            b = sqrt(scale * b);
-
-            pixels[data_pos + 0] = static_cast<int>(256 * clamp(r, 0.0, 0.999));
-            pixels[data_pos + 1] = static_cast<int>(256 * clamp(g, 0.0, 0.999));
-            pixels[data_pos + 2] = static_cast<int>(256 * clamp(b, 0.0, 0.999));
-        }
-
-        return pixels;
-    }
-
-    inline void accumulate(unsigned x, unsigned y, float r, float g, float b) {
-        const unsigned pos = (y * width + x) * 3;
-        data[pos + 0] = r;
-        data[pos + 1] = g;
-        data[pos + 2] = b;
+        beauty.to_rgb8(pixels);
+        return pixels.data();
     }
 
     inline void accumulate(unsigned x, unsigned y, const vec3 &col) {
-        accumulate(x, y, col.x(), col.y(), col.z());
+        beauty.add(x, y, col, samples_per_pixel);
     }
 
     unsigned width;
     unsigned height;
-    float *data;  // RGBA + sample count
+    framebuffer beauty;
 
     private:
-        uint8_t *pixels;  // RGBA
+        std::vector<uint8_t> pixels;  // RGB, top row first
 
 } pixels{image_width, image_height};
 
 struct Task {
     Task() : my_id{id++} {}
 
-    Task(int x, int y) : sx{x}, sy{y}, my_id{id++} {}
-
-    void move_in_pattern(int &rx, int &ry) {
-        // snake pattern implementation
-        static int x = -1, y = H_CNT - 1;
-        static int dir = 0;
-
-        x = dir ? x - 1 : x + 1;
-        if (x == W_CNT || x == -1) {
-            x = y & 1 ? W_CNT - 1 : 0;
-            y--;
-            dir = !dir;
-        }
-        rx = x;
-        ry = y;
-    }
-
-    bool get_next_task() {
-        static bool taken[H_CNT][W_CNT] = {};
-        static std::mutex m;
-
-        std::lock_guard<std::mutex> guard{m};
-
-        bool found = false;
-        int x, y;
-        while (!found) {
-            move_in_pattern(x, y);
-            if (x < 0 || x > W_CNT || y < 0 || y > H_CNT) break;
-
-            if (!taken[y][x]) {
-                sx = x * N;
-                sy = y * N;
-                taken[y][x] = true;
-                found = true;
-            }
-        }
-        return found;
-    }
-
     void operator()() {
-        bool done = false;
-        do {
-            if (!get_next_task()) {
-                done = true;
-                continue;
-            }
-
+        tile t;
+        while (scheduler.next(my_id, t)) {
             camera cam(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus);
 
-            for (unsigned y = sy; y < sy + N; y++)
-            for (unsigned x = sx; x < sx + N; x++) {
-                if (x < 0 || y < 0 || x >= image_width || y >= image_height) continue;
+            for (int y = t.y0; y < t.y1; y++)
+            for (int x = t.x0; x < t.x1; x++) {
                 color col = color(0,0,0);
-                for (unsigned s = 0; s < samples_per_pixel; s++) {
+                for (int s = 0; s < samples_per_pixel; s++) {
+                    seed_sample(0, x, y, s);
                     const float u = float(x + random_double()) / float(image_width);
                     const float v = float(y + random_double()) / float(image_height);
                     ray r = cam.get_ray(u, v);
-                    col += ray_color(r, background, world, max_depth);
+                    r.spread = cam.pixel_spread(image_height);
+                    STAT_RAY(RAY_PRIMARY);
+                    col += ray_color(r, background, world->root(), max_depth);
                 }
                 pixels.accumulate(x, y, col);
             }
-        } while (!done);
+        }
 
         done_count++;
 
         std::cout << "Thread " << my_id << " is done!" << std::endl;
     }
 
-    int sx = -1, sy = -1;
     int my_id;
     static int id;
 };
@@ -182,7 +111,8 @@ struct Task {
 int Task::id = 0;
 
 int main(int argc, char **argv) {
-    const unsigned int n_threads = std::thread::hardware_concurrency() / 4;
+    const unsigned int n_threads = thread_num;
+    scheduler.add_frame(image_width, image_height, tile_size, order);
     std::cout << "Detected " << n_threads << " concurrent threads." << std::endl;
     std::vector<std::thread> threads{n_threads};
 
@@ -224,15 +154,7 @@ int main(int argc, char **argv) {
 					{
 						quit = true;
 
-                        auto image = pixels.get_pixels();
-                        std::ofstream ofs("./output/block.ppm", std::ios::out | std::ios::binary);
-                        ofs << "P6\n" << image_width << " " << image_height << "\n255\n";
-                        for (unsigned i = 0; i < image_width * image_height; ++i) {
-                            ofs << image[i*3+0] <<
-                                image[i*3+1] <<
-                                image[i*3+2];
-                        }
-                        ofs.close();
+                        write_image("./output/block.ppm", pixels.beauty, FORMAT_PPM);
 					}
 
 				}
@@ -267,16 +189,7 @@ int main(int argc, char **argv) {
 	//Quit SDL subsystems
 	SDL_Quit();
 
-    auto image = pixels.get_pixels();
-
-    std::ofstream ofs("./output/block.ppm", std::ios::out | std::ios::binary);
-    ofs << "P6\n" << image_width << " " << image_height << "\n255\n";
-    for (unsigned i = 0; i < image_width * image_height; ++i) {
-        ofs << image[i*3+0] <<
-               image[i*3+1] <<
-               image[i*3+2];
-    }
-    ofs.close();    
+    write_image("./output/block.ppm", pixels.beauty, FORMAT_PPM);
 
     return 0;
 }
\ No newline at end of file
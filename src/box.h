@@ -14,10 +14,26 @@ class box : public hittable  {
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
-            output_box = aabb(box_min, box_max);
+            // padded like the rects, flat boxes would otherwise have a box no ray can hit
+            const vec3 pad(0.0001, 0.0001, 0.0001);
+            output_box = aabb(box_min - pad, box_max + pad);
             return true;
         }
 
+        // Slab test, the box is solid between box_min and box_max.
+        virtual bool intervals(const ray& r, double t_min, double t_max, ray_intervals& out) const override {
+            for (int a = 0; a < 3; a++) {
+                auto inv_d = 1.0 / r.direction()[a];
+                auto t0 = (box_min[a] - r.origin()[a]) * inv_d;
+                auto t1 = (box_max[a] - r.origin()[a]) * inv_d;
+                if (inv_d < 0) std::swap(t0, t1);
+                t_min = t0 > t_min ? t0 : t_min;
+                t_max = t1 < t_max ? t1 : t_max;
+                if (t_max <= t_min) return true;
+            }
+            return out.add(t_min, t_max);
+        }
+
     public:
         point3 box_min;
         point3 box_max;
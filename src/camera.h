@@ -7,6 +7,8 @@
 
 class camera {
     public:
+        virtual ~camera() {}
+
         camera(
             point3 lookfrom,
             point3 lookat,
@@ -14,8 +16,10 @@ class camera {
             double vfov, // vertical field-of-view in degrees
             double aspect_ratio,
             double aperture,
-            double focus_dist
-        ) {
+            double focus_dist,
+            double time0 = 0, // shutter open and close
+            double time1 = 0
+        ) : shutter_open(time0), shutter_close(time1) {
             auto theta = degrees_to_radians(vfov);
             auto h = tan(theta/2);
             auto viewport_height = 2.0 * h;
@@ -31,19 +35,57 @@ class camera {
             lower_left_corner = origin - horizontal/2 - vertical/2 - focus_dist*w;
 
             lens_radius = aperture / 2;
+            fov_height = viewport_height;
+        }
+
+        // Angle covered by one pixel, as the spread of camera rays.
+        virtual double pixel_spread(int image_height) const {
+            return fov_height / image_height;
         }
 
 
-        ray get_ray(double s, double t) const {
+        // The apex and the corner directions, in order around the rectangle, of the pyramid
+        // holding every ray get_ray returns for s in [s0, s1] and t in [t0, t1]. False for
+        // cameras whose rays don't all leave one point, like ones with an aperture.
+        virtual bool ray_pyramid(double s0, double s1, double t0, double t1, point3& apex, vec3 corner[4]) const {
+            if (lens_radius > 0) return false;
+            apex = origin;
+            corner[0] = lower_left_corner + s0*horizontal + t0*vertical - origin;
+            corner[1] = lower_left_corner + s1*horizontal + t0*vertical - origin;
+            corner[2] = lower_left_corner + s1*horizontal + t1*vertical - origin;
+            corner[3] = lower_left_corner + s0*horizontal + t1*vertical - origin;
+            return true;
+        }
+
+        virtual ray get_ray(double s, double t) const {
             vec3 rd = lens_radius * random_in_unit_disk();
             vec3 offset = u * rd.x() + v * rd.y();
 
             return ray(
                 origin + offset,
-                lower_left_corner + s*horizontal + t*vertical - origin - offset
+                lower_left_corner + s*horizontal + t*vertical - origin - offset,
+                shutter_time()
             );
         }
 
+        // the shutter interval, which the scene's bounds have to cover
+        double time0() const { return shutter_open; }
+        double time1() const { return shutter_close; }
+
+    protected:
+        // for cameras that set up their own projection
+        camera() {}
+
+        // A random time while the shutter is open. An instantaneous shutter draws no
+        // random number, so still images keep their samples.
+        double shutter_time() const {
+            return shutter_open < shutter_close ? random_double(shutter_open, shutter_close) : shutter_open;
+        }
+
+    protected:
+        double shutter_open = 0;
+        double shutter_close = 0;
+
     private:
         point3 origin;
         point3 lower_left_corner;
@@ -51,6 +93,7 @@ class camera {
         vec3 vertical;
         vec3 u, v, w;
         double lens_radius;
+        double fov_height;
 };
 
 #endif
\ No newline at end of file
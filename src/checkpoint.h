@@ -0,0 +1,105 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "framebuffer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// Snapshot of an unfinished render: the accumulated radiance and sample count of
+// every pixel plus any extra float planes (AOVs). Because samples are seeded from
+// their index, the per-pixel counts are all the scheduler needs to pick up exactly
+// where the render stopped, or to keep adding samples to a finished image.
+//
+// File layout, little endian:
+//     "RTCK" u32 version, i32 width, i32 height, u64 seed, u32 plane count,
+//     width * height * 3 f32 radiance sums, width * height u32 sample counts,
+//     then for every plane: u32 channels, width * height * channels f32.
+struct checkpoint {
+    uint64_t seed = 0;
+    framebuffer beauty;
+    std::vector<std::vector<float>> planes;
+    std::vector<uint32_t> plane_channels;
+};
+
+const uint32_t checkpoint_version = 1;
+
+// Writes to a temporary file first and renames it over path, so a crash while saving
+// never leaves a truncated checkpoint behind.
+bool save_checkpoint(const std::string& path, const checkpoint& ck) {
+    const framebuffer& fb = ck.beauty;
+
+    std::vector<char> bytes;
+    append_bytes(bytes, "RTCK", 4);
+    const int32_t size[2] = {fb.width, fb.height};
+    const uint32_t plane_count = static_cast<uint32_t>(ck.planes.size());
+    append_bytes(bytes, &checkpoint_version, 4);
+    append_bytes(bytes, size, 8);
+    append_bytes(bytes, &ck.seed, 8);
+    append_bytes(bytes, &plane_count, 4);
+
+    append_bytes(bytes, fb.rgb.data(), fb.rgb.size() * sizeof(float));
+    std::vector<uint32_t> counts(fb.samples.begin(), fb.samples.end());
+    append_bytes(bytes, counts.data(), counts.size() * sizeof(uint32_t));
+
+    for (size_t p = 0; p < ck.planes.size(); p++) {
+        append_bytes(bytes, &ck.plane_channels[p], 4);
+        append_bytes(bytes, ck.planes[p].data(), ck.planes[p].size() * sizeof(float));
+    }
+
+    const std::string tmp = path + ".tmp";
+    std::FILE* f = std::fopen(tmp.c_str(), "wb");
+    if (!f) return false;
+    bool ok = std::fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    ok = std::fflush(f) == 0 && ok;
+    ok = fsync(fileno(f)) == 0 && ok;
+    ok = std::fclose(f) == 0 && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool load_checkpoint(const std::string& path, checkpoint& ck) {
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) return false;
+
+    auto read = [&](void* data, size_t n) { return std::fread(data, 1, n, f) == n; };
+
+    char magic[4];
+    uint32_t version, plane_count;
+    int32_t size[2];
+    bool ok = read(magic, 4) && std::memcmp(magic, "RTCK", 4) == 0
+        && read(&version, 4) && version == checkpoint_version
+        && read(size, 8) && size[0] > 0 && size[1] > 0
+        && read(&ck.seed, 8) && read(&plane_count, 4);
+
+    if (ok) {
+        ck.beauty = framebuffer(size[0], size[1]);
+        std::vector<uint32_t> counts(ck.beauty.pixel_count());
+        ok = read(ck.beauty.rgb.data(), ck.beauty.rgb.size() * sizeof(float))
+            && read(counts.data(), counts.size() * sizeof(uint32_t));
+        ck.beauty.samples.assign(counts.begin(), counts.end());
+    }
+
+    ck.planes.clear();
+    ck.plane_channels.clear();
+    for (uint32_t p = 0; ok && p < plane_count; p++) {
+        uint32_t channels;
+        ok = read(&channels, 4) && channels > 0 && channels <= 4;
+        if (!ok) break;
+        ck.plane_channels.push_back(channels);
+        ck.planes.emplace_back(ck.beauty.pixel_count() * channels);
+        ok = read(ck.planes.back().data(), ck.planes.back().size() * sizeof(float));
+    }
+
+    std::fclose(f);
+    return ok;
+}
+
+#endif
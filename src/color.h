@@ -3,43 +3,64 @@
 
 #include "vec3.h"
 
-#include <iostream>
-
-void write_color(std::ostream &out, color pixel_color, int samples_per_pixel) {
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
-
-    // Divide the color by the number of samples.
-    auto scale = 1.0 / samples_per_pixel;
-    r = sqrt(scale * r);
-    g = sqrt(scale * g);
-    b = sqrt(scale * b);
-
-    // Write the translated [0,255] value of each color component.
-    out << static_cast<int>(256 * clamp(r, 0.0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(g, 0.0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
+#include <cstdint>
+#include <cstring>
+
+// Color conversions used by the image encoders. They work on flat float arrays
+// without branches in the inner loops so the compiler can vectorize them.
+
+// Applies the per-pixel sample scale and gamma 2, writing 8 bit values.
+void tonemap_8bit(const float* in, const float* scale, uint8_t* out, size_t pixel_count) {
+    for (size_t i = 0; i < pixel_count * 3; i++) {
+        float v = std::sqrt(scale[i / 3] * in[i]);
+        v = v < 0.0f ? 0.0f : (v > 0.999f ? 0.999f : v);
+        out[i] = static_cast<uint8_t>(256.0f * v);
+    }
+}
+
+// Same as tonemap_8bit but with 16 bits of precision.
+void tonemap_16bit(const float* in, const float* scale, uint16_t* out, size_t pixel_count) {
+    for (size_t i = 0; i < pixel_count * 3; i++) {
+        float v = std::sqrt(scale[i / 3] * in[i]);
+        v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+        out[i] = static_cast<uint16_t>(65535.0f * v + 0.5f);
+    }
 }
 
-std::string get_color_string(color pixel_color, int samples_per_pixel) {
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
+// Applies only the per-pixel sample scale, for the linear float formats.
+void scale_linear(const float* in, const float* scale, float* out, size_t pixel_count) {
+    for (size_t i = 0; i < pixel_count * 3; i++) {
+        out[i] = scale[i / 3] * in[i];
+    }
+}
+
+inline uint16_t float_to_half(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+
+    uint32_t sign = (x >> 16) & 0x8000;
+    int32_t exponent = static_cast<int32_t>((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = x & 0x7fffff;
 
-    // Divide the color by the number of samples.
-    auto scale = 1.0 / samples_per_pixel;
-    r = sqrt(scale * r);
-    g = sqrt(scale * g);
-    b = sqrt(scale * b);
+    // infinity and nan
+    if (((x >> 23) & 0xff) == 0xff) return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    // too large for a half, clamp to infinity
+    if (exponent >= 31) return sign | 0x7c00;
 
-    // Write the translated [0,255] value of each color component.
-    std::string out;
-    out += std::to_string(static_cast<int>(256 * clamp(r, 0.0, 0.999))) + ' '
-        + std::to_string(static_cast<int>(256 * clamp(g, 0.0, 0.999))) + ' '
-        + std::to_string(static_cast<int>(256 * clamp(b, 0.0, 0.999))) + '\n';
+    if (exponent <= 0) {
+        // denormal half or zero
+        if (exponent < -10) return sign;
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t h = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1) h++;
+        return static_cast<uint16_t>(sign | h);
+    }
 
-    return out;
+    // rounding may carry into the exponent, which gives the correct result
+    uint32_t h = sign | (exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000) h++;
+    return static_cast<uint16_t>(h);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -35,10 +35,35 @@ class constant_medium : public hittable {
 };
 
 bool constant_medium::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    STAT_PRIMITIVE(PRIM_MEDIUM);
     // Print occasional samples when debugging. To enable, set enableDebug true.
     const bool enableDebug = false;
     const bool debugging = enableDebug && random_double() < 0.00001;
 
+    const auto ray_length = r.direction().length();
+
+    // Closed boundaries report all their inside ranges at once, which also works for
+    // concave or disjoint ones. The free path is spent across the ranges in order.
+    ray_intervals inside;
+    if (boundary->intervals(r, fmax(t_min, 0.0), t_max, inside)) {
+        if (inside.count == 0) return false;
+
+        auto hit_distance = neg_inv_density * log(random_double());
+        for (int i = 0; i < inside.count; i++) {
+            const auto length = (inside.t1[i] - inside.t0[i]) * ray_length;
+            if (hit_distance <= length) {
+                rec.t = inside.t0[i] + hit_distance / ray_length;
+                rec.p = r.at(rec.t);
+                rec.normal = vec3(1,0,0);  // arbitrary
+                rec.front_face = true;     // also arbitrary
+                rec.mat_ptr = phase_function;
+                return true;
+            }
+            hit_distance -= length;
+        }
+        return false;
+    }
+
     hit_record rec1, rec2;
 
     if (!boundary->hit(r, -infinity, infinity, rec1))
@@ -58,7 +83,6 @@ bool constant_medium::hit(const ray& r, double t_min, double t_max, hit_record&
     if (rec1.t < 0)
         rec1.t = 0;
 
-    const auto ray_length = r.direction().length();
     const auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
     const auto hit_distance = neg_inv_density * log(random_double());
 
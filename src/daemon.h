@@ -0,0 +1,370 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "distributed.h"
+#include "framebuffer.h"
+#include "presets.h"
+#include "render.h"
+#include "render_pool.h"
+#include "scene.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// A long running renderer that answers render requests over a Unix domain socket.
+//
+// Starting a render from scratch means building the scene and its BVH and starting the
+// threads, which for small interactive renders takes longer than the rendering itself.
+// The daemon keeps the render_pool's threads and the scenes of recent requests around,
+// so a request for a scene it has seen before only pays for its samples. Finished tiles
+// are sent back as soon as they are done, so a client can show the image build up.
+//
+// Every client connection gets its own thread that reads requests and writes tiles, while
+// the tiles themselves are rendered on the shared pool. As in distributed.h, both sides
+// are the same build on the same machine, so messages are plain structs.
+
+const uint32_t daemon_magic = 0x52544432; // "RTD2"
+
+enum daemon_command : int32_t {
+    DAEMON_RENDER = 0,
+    DAEMON_SHUTDOWN = 1 // stops the daemon once running renders are done
+};
+
+// A render of a preset scene. The camera is the preset's unless custom_camera is set.
+struct daemon_request {
+    uint32_t magic;
+    int32_t command;
+    char scene[32];
+    double scene_param;
+    uint64_t seed;
+    int32_t width, height;
+    int32_t samples_per_pixel;
+    int32_t max_depth;
+    int32_t x0, y0, x1, y1;  // the pixels to render, rows from the bottom; empty for all
+    int32_t custom_camera;
+    double lookfrom[3], lookat[3], vup[3];
+    double vfov, aperture, focus_dist;
+};
+
+enum daemon_reply_kind : int32_t {
+    DAEMON_TILE = 0,  // followed by pixel_count * 3 floats, radiance sums in row order
+    DAEMON_DONE = 1,  // the last reply to a render
+    DAEMON_ERROR = 2  // the request was rejected, nothing else follows
+};
+
+struct daemon_reply {
+    int32_t kind;
+    int32_t x0, y0, x1, y1;
+    int32_t samples;     // per pixel, the sums are divided by this
+    int32_t pixel_count;
+};
+
+// A request filled in from a preset, rendering the whole image with its camera.
+inline daemon_request make_daemon_request(const std::string& scene, double param, int width, int height, int samples_per_pixel) {
+    daemon_request req{};
+    req.magic = daemon_magic;
+    req.command = DAEMON_RENDER;
+    std::strncpy(req.scene, scene.c_str(), sizeof(req.scene) - 1);
+    req.scene_param = param;
+    req.seed = 1;
+    req.width = width;
+    req.height = height;
+    req.samples_per_pixel = samples_per_pixel;
+    req.max_depth = 10;
+    req.vup[1] = 1;
+    req.vfov = 40;
+    req.focus_dist = 10;
+    return req;
+}
+
+class render_daemon {
+    public:
+        // Keeps up to max_scenes scenes loaded, dropping the least recently used.
+        explicit render_daemon(const std::string& path, unsigned threads = default_thread_count(), size_t max_scenes = 4)
+            : socket_path(path), scene_limit(std::max<size_t>(max_scenes, 1)), pool(threads) {}
+
+        render_daemon(const render_daemon&) = delete;
+        render_daemon& operator=(const render_daemon&) = delete;
+
+        // Serves clients until one sends DAEMON_SHUTDOWN. Returns false if the socket
+        // could not be opened.
+        bool run();
+
+    private:
+        struct warm_scene {
+            std::string name;
+            double param;
+            uint64_t seed;
+            scene_preset preset;
+            shared_ptr<const scene> world;
+            uint64_t last_used;
+        };
+
+        // The tiles of one render on their way from the pool to the client.
+        struct tile_stream {
+            std::mutex m;
+            std::condition_variable ready;
+            std::deque<std::pair<tile, std::vector<float>>> tiles;
+            bool finished = false;
+            std::atomic<bool> cancelled{false}; // the client went away
+        };
+
+        shared_ptr<const warm_scene> acquire(const daemon_request& req);
+
+        void serve(int fd);
+
+        bool render(int fd, const daemon_request& req);
+
+        static bool reply(int fd, int32_t kind, const tile& t = tile{0, 0, 0, 0}, int samples = 0, const std::vector<float>* sums = nullptr) {
+            const int32_t count = sums ? static_cast<int32_t>(sums->size() / 3) : 0;
+            daemon_reply r{kind, t.x0, t.y0, t.x1, t.y1, samples, count};
+            return write_all(fd, &r, sizeof(r)) && (!sums || write_all(fd, sums->data(), sums->size() * sizeof(float)));
+        }
+
+    private:
+        std::string socket_path;
+        size_t scene_limit;
+
+        std::mutex scenes_mutex;
+        std::vector<shared_ptr<warm_scene>> scenes;
+        uint64_t use_counter = 0;
+
+        std::mutex clients_mutex;
+        std::condition_variable clients_done;
+        int live_clients = 0;
+
+        std::atomic<bool> stopping{false};
+        render_pool pool;
+};
+
+bool render_daemon::run() {
+    std::signal(SIGPIPE, SIG_IGN);
+
+    const int listen_fd = listen_unix(socket_path);
+    if (listen_fd < 0) {
+        std::cerr << "daemon: could not listen on " << socket_path << "\n";
+        return false;
+    }
+    std::cerr << "daemon: listening on " << socket_path << " with " << pool.thread_count() << " threads\n";
+
+    while (!stopping) {
+        // wake up now and then to notice a shutdown sent on another connection
+        pollfd p{listen_fd, POLLIN, 0};
+        const int n = poll(&p, 1, 200);
+        if (n < 0 && errno != EINTR) break;
+        if (n <= 0 || !(p.revents & POLLIN)) continue;
+
+        const int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) continue;
+
+        // client threads are detached, so a long running daemon doesn't collect finished
+        // ones; the count tells shutdown when the last is gone
+        {
+            std::lock_guard<std::mutex> lock(clients_mutex);
+            live_clients++;
+        }
+        std::thread([this, fd] {
+            serve(fd);
+            // notified under the lock, so run can't return while this thread still uses it
+            std::lock_guard<std::mutex> lock(clients_mutex);
+            if (--live_clients == 0) clients_done.notify_all();
+        }).detach();
+    }
+
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    std::unique_lock<std::mutex> lock(clients_mutex);
+    clients_done.wait(lock, [&] { return live_clients == 0; });
+    return true;
+}
+
+void render_daemon::serve(int fd) {
+    trace_thread_name("daemon client " + std::to_string(fd));
+    daemon_request req;
+    // a client can send any number of requests, one after the other
+    while (!stopping) {
+        // an idle client must not keep the daemon from shutting down
+        pollfd p{fd, POLLIN, 0};
+        const int n = poll(&p, 1, 200);
+        if (n < 0 && errno != EINTR) break;
+        if (n <= 0) continue;
+        if (!read_all(fd, &req, sizeof(req))) break;
+
+        if (req.magic != daemon_magic) {
+            std::cerr << "daemon: bad request\n";
+            break;
+        }
+        if (req.command == DAEMON_SHUTDOWN) {
+            stopping = true;
+            reply(fd, DAEMON_DONE);
+            break;
+        }
+        if (!render(fd, req)) break;
+    }
+    close(fd);
+}
+
+shared_ptr<const render_daemon::warm_scene> render_daemon::acquire(const daemon_request& req) {
+    const std::string name(req.scene, strnlen(req.scene, sizeof(req.scene)));
+
+    // Scenes are built under the lock: building one is quick next to rendering it, and
+    // two clients asking for the same new scene then build it only once.
+    std::lock_guard<std::mutex> lock(scenes_mutex);
+    use_counter++;
+    for (auto& s : scenes) {
+        if (s->name == name && s->param == req.scene_param && s->seed == req.seed) {
+            s->last_used = use_counter;
+            return s;
+        }
+    }
+
+    auto s = std::make_shared<warm_scene>();
+    // the same seed as dist.exe uses, so random scenes match
+    seed_random(req.seed);
+    if (!load_preset(name, req.scene_param, s->preset)) return nullptr;
+    s->name = name;
+    s->param = req.scene_param;
+    s->seed = req.seed;
+    s->world = scene_builder(s->preset.objects).commit(s->preset.time0, s->preset.time1);
+    s->last_used = use_counter;
+
+    if (scenes.size() >= scene_limit) {
+        // renders still using the dropped scene keep it alive through their shared_ptr
+        auto oldest = std::min_element(scenes.begin(), scenes.end(),
+            [](const shared_ptr<warm_scene>& a, const shared_ptr<warm_scene>& b) { return a->last_used < b->last_used; });
+        scenes.erase(oldest);
+    }
+    scenes.push_back(s);
+    return s;
+}
+
+bool render_daemon::render(int fd, const daemon_request& req) {
+    if (req.width < 1 || req.height < 1 || req.width > 16384 || req.height > 16384
+        || req.samples_per_pixel < 1 || req.max_depth < 1) {
+        std::cerr << "daemon: bad render settings\n";
+        return reply(fd, DAEMON_ERROR);
+    }
+
+    // an empty region is the whole image, any other is clipped to it
+    tile region{0, 0, req.width, req.height};
+    if (req.x1 > req.x0 && req.y1 > req.y0) {
+        region = tile{std::max(req.x0, 0), std::max(req.y0, 0), std::min(req.x1, req.width), std::min(req.y1, req.height)};
+    }
+    if (region.x1 <= region.x0 || region.y1 <= region.y0) return reply(fd, DAEMON_DONE);
+
+    shared_ptr<const warm_scene> warm = acquire(req);
+    if (!warm) {
+        std::cerr << "daemon: unknown scene " << std::string(req.scene, strnlen(req.scene, sizeof(req.scene))) << "\n";
+        return reply(fd, DAEMON_ERROR);
+    }
+
+    const double aspect_ratio = double(req.width) / req.height;
+    const scene_preset& preset = warm->preset;
+    const camera cam = req.custom_camera
+        ? camera(point3(req.lookfrom[0], req.lookfrom[1], req.lookfrom[2]),
+                 point3(req.lookat[0], req.lookat[1], req.lookat[2]),
+                 vec3(req.vup[0], req.vup[1], req.vup[2]),
+                 req.vfov, aspect_ratio, req.aperture, req.focus_dist, preset.time0, preset.time1)
+        : preset.make_camera(aspect_ratio);
+
+    // the job covers the region, and its tiles are moved into place when rendered
+    auto stream = std::make_shared<tile_stream>();
+    auto job = std::make_shared<frame_job>();
+    job->width = region.x1 - region.x0;
+    job->height = region.y1 - region.y0;
+    job->render_tile = [warm, stream, cam, req, region](frame_job&, const tile& local) {
+        if (stream->cancelled) return;
+        const tile t{local.x0 + region.x0, local.y0 + region.y0, local.x1 + region.x0, local.y1 + region.y0};
+        std::vector<float> sums;
+        sums.reserve(static_cast<size_t>(t.x1 - t.x0) * (t.y1 - t.y0) * 3);
+        for (int y = t.y0; y < t.y1; y++)
+        for (int x = t.x0; x < t.x1; x++) {
+            const color c = render_pixel(cam, x, y, req.width, req.height, req.samples_per_pixel,
+                warm->world->root(), req.max_depth, warm->preset.background, frame_seed(req.seed, 0));
+            sums.push_back(static_cast<float>(c.x()));
+            sums.push_back(static_cast<float>(c.y()));
+            sums.push_back(static_cast<float>(c.z()));
+        }
+        std::lock_guard<std::mutex> lock(stream->m);
+        stream->tiles.emplace_back(t, std::move(sums));
+        stream->ready.notify_one();
+    };
+    job->on_done = [stream](frame_job&) {
+        std::lock_guard<std::mutex> lock(stream->m);
+        stream->finished = true;
+        stream->ready.notify_one();
+    };
+    pool.submit(job);
+
+    // the pool renders while this thread sends, so a slow client never holds up a worker
+    while (true) {
+        std::pair<tile, std::vector<float>> next;
+        {
+            std::unique_lock<std::mutex> lock(stream->m);
+            stream->ready.wait(lock, [&] { return stream->finished || !stream->tiles.empty(); });
+            if (stream->tiles.empty()) break;
+            next = std::move(stream->tiles.front());
+            stream->tiles.pop_front();
+        }
+        if (!reply(fd, DAEMON_TILE, next.first, req.samples_per_pixel, &next.second)) {
+            // the rest of the tiles are skipped by the pool
+            stream->cancelled = true;
+            return false;
+        }
+    }
+    return reply(fd, DAEMON_DONE);
+}
+
+// Client side: sends req and adds every tile that comes back to fb, which must be
+// req.width by req.height. on_tile, if given, is called after each one. Returns false
+// when the daemon could not be reached or rejected the request.
+bool render_remote(const std::string& socket_path, const daemon_request& req, framebuffer& fb,
+    const std::function<void(const daemon_reply&)>& on_tile = nullptr)
+{
+    const int fd = connect_unix(socket_path);
+    if (fd < 0) {
+        std::cerr << "could not connect to " << socket_path << "\n";
+        return false;
+    }
+
+    bool ok = write_all(fd, &req, sizeof(req));
+    std::vector<float> sums;
+    daemon_reply r;
+    while (ok && (ok = read_all(fd, &r, sizeof(r))) && r.kind == DAEMON_TILE) {
+        const int expected = (r.x1 - r.x0) * (r.y1 - r.y0);
+        ok = r.pixel_count == expected && r.x0 >= 0 && r.y0 >= 0 && r.x1 <= fb.width && r.y1 <= fb.height;
+        sums.resize(static_cast<size_t>(std::max(expected, 0)) * 3);
+        ok = ok && read_all(fd, sums.data(), sums.size() * sizeof(float));
+        if (!ok) break;
+
+        size_t i = 0;
+        for (int y = r.y0; y < r.y1; y++)
+        for (int x = r.x0; x < r.x1; x++, i += 3) {
+            fb.add(x, y, color(sums[i], sums[i+1], sums[i+2]), r.samples);
+        }
+        if (on_tile) on_tile(r);
+    }
+    close(fd);
+
+    if (ok && r.kind == DAEMON_ERROR) std::cerr << "the daemon rejected the request\n";
+    return ok && r.kind == DAEMON_DONE;
+}
+
+#endif
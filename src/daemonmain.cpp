@@ -0,0 +1,132 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "daemon.h"
+#include "framebuffer.h"
+
+// Render daemon and its command line client. Start the daemon with
+//     ./daemon.exe --serve
+// and send it renders from other shells, which come back much faster than a fresh
+// process once the scene is loaded:
+//     ./daemon.exe --scene di_test --width 256 --height 256 --spp 16
+//     ./daemon.exe --stop
+
+void usage() {
+    std::cerr << "usage: daemon.exe --serve [--socket path] [--threads n] [--scenes n]\n"
+              << "       daemon.exe [--socket path] [--scene name] [--param x] [--seed n]\n"
+              << "                  [--width w] [--height h] [--spp n] [--max-depth n]\n"
+              << "                  [--region x0 y0 x1 y1] [--lookfrom x y z] [--lookat x y z]\n"
+              << "                  [--vfov degrees] [--aperture a] [--focus distance] [--out path]\n"
+              << "       daemon.exe --stop [--socket path]\n";
+}
+
+int main(int argc, char **argv) {
+    std::string socket_path = "/tmp/raytracer-daemon.sock";
+    std::string out = "output/daemon.ppm";
+    bool serve = false, stop = false;
+    unsigned threads = default_thread_count();
+    int max_scenes = 4;
+    daemon_request req = make_daemon_request("di_test", 0.5, 256, 256, 16);
+    std::vector<int> camera_args; // where the camera options are in argv
+
+    // reads count numbers after the option at argv[i]
+    auto numbers = [&](int& i, int count, double* values) {
+        if (i + count >= argc) return false;
+        for (int k = 0; k < count; k++) values[k] = std::atof(argv[++i]);
+        return true;
+    };
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        double v[4];
+        if (arg == "--serve") serve = true;
+        else if (arg == "--stop") stop = true;
+        else if (arg == "--socket" && i + 1 < argc) socket_path = argv[++i];
+        else if (arg == "--threads" && numbers(i, 1, v)) threads = static_cast<unsigned>(v[0]);
+        else if (arg == "--scenes" && numbers(i, 1, v)) max_scenes = static_cast<int>(v[0]);
+        else if (arg == "--scene" && i + 1 < argc) {
+            req.scene[0] = '\0';
+            std::strncat(req.scene, argv[++i], sizeof(req.scene) - 1);
+        }
+        else if (arg == "--param" && numbers(i, 1, v)) req.scene_param = v[0];
+        else if (arg == "--seed" && i + 1 < argc) req.seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--width" && numbers(i, 1, v)) req.width = static_cast<int32_t>(v[0]);
+        else if (arg == "--height" && numbers(i, 1, v)) req.height = static_cast<int32_t>(v[0]);
+        else if (arg == "--spp" && numbers(i, 1, v)) req.samples_per_pixel = static_cast<int32_t>(v[0]);
+        else if (arg == "--max-depth" && numbers(i, 1, v)) req.max_depth = static_cast<int32_t>(v[0]);
+        else if (arg == "--region" && numbers(i, 4, v)) {
+            req.x0 = static_cast<int32_t>(v[0]);
+            req.y0 = static_cast<int32_t>(v[1]);
+            req.x1 = static_cast<int32_t>(v[2]);
+            req.y1 = static_cast<int32_t>(v[3]);
+        }
+        else if ((arg == "--lookfrom" || arg == "--lookat") && numbers(i, 3, v)) camera_args.push_back(i - 3);
+        else if ((arg == "--vfov" || arg == "--aperture" || arg == "--focus") && numbers(i, 1, v)) camera_args.push_back(i - 1);
+        else if (arg == "--out" && i + 1 < argc) out = argv[++i];
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (serve) {
+        render_daemon daemon(socket_path, threads, static_cast<size_t>(std::max(max_scenes, 1)));
+        return daemon.run() ? 0 : 1;
+    }
+
+    if (stop) {
+        daemon_request quit = req;
+        quit.command = DAEMON_SHUTDOWN;
+        framebuffer none;
+        return render_remote(socket_path, quit, none) ? 0 : 1;
+    }
+
+    if (req.width < 1 || req.height < 1 || req.samples_per_pixel < 1) {
+        usage();
+        return 1;
+    }
+
+    if (!camera_args.empty()) {
+        // starts from the preset's camera, so options that were left out keep its values
+        scene_preset preset;
+        if (!load_preset(req.scene, req.scene_param, preset)) {
+            std::cerr << "unknown scene " << req.scene << "\n";
+            return 1;
+        }
+        for (int a = 0; a < 3; a++) {
+            req.lookfrom[a] = preset.lookfrom[a];
+            req.lookat[a] = preset.lookat[a];
+            req.vup[a] = preset.vup[a];
+        }
+        req.vfov = preset.vfov;
+        req.aperture = preset.aperture;
+        req.focus_dist = preset.dist_to_focus;
+        for (int i : camera_args) {
+            const std::string arg = argv[i];
+            if (arg == "--lookfrom") numbers(i, 3, req.lookfrom);
+            else if (arg == "--lookat") numbers(i, 3, req.lookat);
+            else if (arg == "--vfov") numbers(i, 1, &req.vfov);
+            else if (arg == "--aperture") numbers(i, 1, &req.aperture);
+            else numbers(i, 1, &req.focus_dist);
+        }
+        req.custom_camera = 1;
+    }
+
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+    double first_tile = -1;
+    int tiles = 0;
+    framebuffer fb(req.width, req.height);
+    const bool ok = render_remote(socket_path, req, fb, [&](const daemon_reply&) {
+        if (first_tile < 0) first_tile = std::chrono::duration<double>(clock::now() - start).count();
+        tiles++;
+    });
+    if (!ok) return 1;
+
+    const double total = std::chrono::duration<double>(clock::now() - start).count();
+    std::cerr << tiles << " tiles, first after " << first_tile << " s, all after " << total << " s\n";
+    return write_image(out, fb, FORMAT_PPM) ? 0 : 1;
+}
@@ -0,0 +1,75 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "distributed.h"
+#include "framebuffer.h"
+
+// Multi-process renderer. Run without --worker to start a coordinator, which forks
+// --workers local worker processes. More workers can join from other shells with
+//     ./dist.exe --worker /tmp/raytracer.sock
+
+void usage() {
+    std::cerr << "usage: dist.exe [--scene name] [--param x] [--frames n] [--param-step d]\n"
+              << "                [--width w] [--height h] [--spp n] [--max-depth n]\n"
+              << "                [--tile n] [--chunk n] [--workers n] [--seed n]\n"
+              << "                [--socket path] [--format ppm|ppm16|pfm|exr|qoi] [--crash-after n]\n"
+              << "       dist.exe --worker socket_path\n";
+}
+
+int main(int argc, char **argv) {
+    dist_settings settings;
+    image_format format = FORMAT_PPM;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) { usage(); return 1; }
+        std::string value = argv[++i];
+
+        if (arg == "--worker") return run_worker(value);
+        else if (arg == "--scene") settings.scene = value;
+        else if (arg == "--param") settings.scene_param = std::atof(value.c_str());
+        else if (arg == "--frames") settings.frames = std::atoi(value.c_str());
+        else if (arg == "--param-step") settings.param_step = std::atof(value.c_str());
+        else if (arg == "--width") settings.width = std::atoi(value.c_str());
+        else if (arg == "--height") settings.height = std::atoi(value.c_str());
+        else if (arg == "--spp") settings.samples_per_pixel = std::atoi(value.c_str());
+        else if (arg == "--max-depth") settings.max_depth = std::atoi(value.c_str());
+        else if (arg == "--tile") settings.tile_size = std::atoi(value.c_str());
+        else if (arg == "--chunk") settings.samples_per_job = std::atoi(value.c_str());
+        else if (arg == "--workers") settings.local_workers = std::atoi(value.c_str());
+        else if (arg == "--seed") settings.seed = std::strtoull(value.c_str(), nullptr, 10);
+        else if (arg == "--socket") settings.socket_path = value;
+        else if (arg == "--crash-after") settings.crash_after = std::atoi(value.c_str());
+        else if (arg == "--format") {
+            if (!parse_format(value, format)) { usage(); return 1; }
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (settings.frames < 1 || settings.width < 1 || settings.height < 1 || settings.samples_per_pixel < 1
+        || settings.tile_size < 1 || settings.samples_per_job < 1) {
+        usage();
+        return 1;
+    }
+
+    scene_preset check;
+    if (!load_preset(settings.scene, settings.scene_param, check)) {
+        std::cerr << "unknown scene " << settings.scene << "\n";
+        return 1;
+    }
+
+    std::vector<framebuffer> frames;
+    coordinator c(settings);
+    if (!c.run(frames)) return 1;
+
+    for (int f = 0; f < settings.frames; f++) {
+        std::string num = std::string(3 - std::to_string(f).length(), '0') + std::to_string(f);
+        write_image("output/dist" + num + image_extension(format), frames[f], format);
+    }
+
+    return 0;
+}
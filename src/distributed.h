@@ -0,0 +1,391 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "rtweekend.h"
+
+#include "framebuffer.h"
+#include "presets.h"
+#include "scene.h"
+#include "tile_scheduler.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Coordinator / worker rendering over a Unix domain socket.
+//
+// The coordinator cuts every frame into jobs of one tile and a range of samples and
+// hands them to whichever worker process is free. Workers send back the radiance sums
+// of their tile, which the coordinator adds into the frame. Samples are seeded from
+// their pixel and index (seed_sample), so a job gives the same result on any worker
+// and a job lost with a dead worker can simply be handed to another one.
+//
+// Both sides run the same binary on the same machine, so messages are plain structs.
+
+const uint32_t dist_magic = 0x52544431; // "RTD1"
+
+// Sent once to every worker after it connects.
+struct dist_config {
+    uint32_t magic;
+    char scene[32];
+    int32_t width;
+    int32_t height;
+    int32_t max_depth;
+    uint64_t seed;
+};
+
+// A tile and sample range of one frame, id < 0 tells the worker to exit.
+struct dist_job {
+    int32_t id;
+    int32_t frame;
+    double scene_param;
+    int32_t x0, y0, x1, y1;
+    int32_t s0, s1;
+};
+
+// Followed by pixel_count * 3 floats, the radiance sums of the tile in row order.
+struct dist_result {
+    int32_t id;
+    int32_t pixel_count;
+};
+
+// The sample seed of one frame. Seed and frame are mixed rather than added, so frame 1
+// of one seed doesn't render the same samples as frame 0 of the next.
+inline uint64_t frame_seed(uint64_t seed, int frame) {
+    uint64_t key = seed ^ (static_cast<uint64_t>(static_cast<uint32_t>(frame)) << 32);
+    return splitmix64(key);
+}
+
+bool write_all(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = ::write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool read_all(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = ::read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+int connect_unix(const std::string& path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int listen_unix(const std::string& path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    unlink(path.c_str());
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Worker side: renders jobs until told to stop. With crash_after >= 0 the worker dies
+// without answering its crash_after-th job, to exercise the coordinator's recovery.
+int run_worker(const std::string& socket_path, int crash_after = -1) {
+    int fd = connect_unix(socket_path);
+    if (fd < 0) {
+        std::cerr << "worker: could not connect to " << socket_path << "\n";
+        return 1;
+    }
+
+    dist_config config;
+    if (!read_all(fd, &config, sizeof(config)) || config.magic != dist_magic) {
+        std::cerr << "worker: bad handshake\n";
+        close(fd);
+        return 1;
+    }
+    config.scene[sizeof(config.scene) - 1] = '\0';
+
+    shared_ptr<const scene> world;
+    scene_preset preset;
+    double loaded_param = 0;
+    std::vector<float> sums;
+    int jobs_done = 0;
+
+    dist_job job;
+    while (read_all(fd, &job, sizeof(job)) && job.id >= 0) {
+        if (crash_after >= 0 && jobs_done == crash_after) _exit(1);
+
+        if (!world || job.scene_param != loaded_param) {
+            // every process builds the scene from the same seed, so random scenes match
+            seed_random(config.seed);
+            if (!load_preset(config.scene, job.scene_param, preset)) {
+                std::cerr << "worker: unknown scene " << config.scene << "\n";
+                break;
+            }
+            world = scene_builder(preset.objects).commit(preset.time0, preset.time1);
+            loaded_param = job.scene_param;
+        }
+
+        const camera cam = preset.make_camera(double(config.width) / config.height);
+        sums.clear();
+        for (int y = job.y0; y < job.y1; y++)
+        for (int x = job.x0; x < job.x1; x++) {
+            color c = render_pixel(cam, x, y, config.width, config.height, job.s1 - job.s0,
+                world->root(), config.max_depth, preset.background, frame_seed(config.seed, job.frame), job.s0);
+            sums.push_back(static_cast<float>(c.x()));
+            sums.push_back(static_cast<float>(c.y()));
+            sums.push_back(static_cast<float>(c.z()));
+        }
+
+        dist_result result{job.id, static_cast<int32_t>(sums.size() / 3)};
+        if (!write_all(fd, &result, sizeof(result)) || !write_all(fd, sums.data(), sums.size() * sizeof(float))) break;
+        jobs_done++;
+    }
+
+    close(fd);
+    return 0;
+}
+
+struct dist_settings {
+    std::string socket_path = "/tmp/raytracer.sock";
+    std::string scene = "di_test";
+    double scene_param = 0.5;
+    double param_step = 0.0;   // change of scene_param per frame, for sweeps
+    int frames = 1;
+    int width = 256;
+    int height = 256;
+    int samples_per_pixel = 32;
+    int max_depth = 10;
+    int tile_size = 32;
+    int samples_per_job = 8;
+    int local_workers = 2;
+    int crash_after = -1;      // passed to the first local worker
+    uint64_t seed = 1;
+};
+
+// Coordinator side: renders all frames with local (and any externally started) workers.
+class coordinator {
+    public:
+        explicit coordinator(const dist_settings& s) : settings(s) {}
+
+        bool run(std::vector<framebuffer>& frames) {
+            std::signal(SIGPIPE, SIG_IGN);
+
+            listen_fd = listen_unix(settings.socket_path);
+            if (listen_fd < 0) {
+                std::cerr << "coordinator: could not listen on " << settings.socket_path << "\n";
+                return false;
+            }
+
+            frames.assign(settings.frames, framebuffer(settings.width, settings.height));
+            queue_jobs();
+
+            for (int i = 0; i < settings.local_workers; i++) spawn_worker(i == 0 ? settings.crash_after : -1);
+
+            bool ok = event_loop(frames);
+
+            for (auto& w : workers) {
+                dist_job quit{};
+                quit.id = -1;
+                write_all(w.first, &quit, sizeof(quit));
+                close(w.first);
+            }
+            workers.clear();
+            close(listen_fd);
+            unlink(settings.socket_path.c_str());
+            for (pid_t pid : children) waitpid(pid, nullptr, 0);
+            return ok;
+        }
+
+    private:
+        struct worker_state {
+            bool busy = false;
+            dist_job job;
+        };
+
+        void queue_jobs() {
+            // sample ranges are the outer loop so the whole frame converges evenly
+            int id = 0;
+            for (int f = 0; f < settings.frames; f++) {
+                auto tiles = tile_scheduler::make_tiles(settings.width, settings.height, settings.tile_size, ORDER_HILBERT, f);
+                for (int s0 = 0; s0 < settings.samples_per_pixel; s0 += settings.samples_per_job)
+                for (const auto& t : tiles) {
+                    dist_job job;
+                    job.id = id++;
+                    job.frame = f;
+                    job.scene_param = settings.scene_param + f * settings.param_step;
+                    job.x0 = t.x0; job.y0 = t.y0; job.x1 = t.x1; job.y1 = t.y1;
+                    job.s0 = s0;
+                    job.s1 = std::min(s0 + settings.samples_per_job, settings.samples_per_pixel);
+                    pending.push_back(job);
+                }
+            }
+            total_jobs = id;
+        }
+
+        void spawn_worker(int crash_after) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(listen_fd);
+                _exit(run_worker(settings.socket_path, crash_after));
+            }
+            if (pid > 0) children.push_back(pid);
+        }
+
+        void send_config(int fd) {
+            dist_config config{};
+            config.magic = dist_magic;
+            std::strncpy(config.scene, settings.scene.c_str(), sizeof(config.scene) - 1);
+            config.width = settings.width;
+            config.height = settings.height;
+            config.max_depth = settings.max_depth;
+            config.seed = settings.seed;
+            if (!write_all(fd, &config, sizeof(config))) drop_worker(fd);
+        }
+
+        void dispatch() {
+            for (auto& w : workers) {
+                if (w.second.busy || pending.empty()) continue;
+                w.second.job = pending.front();
+                pending.pop_front();
+                w.second.busy = true;
+                if (!write_all(w.first, &w.second.job, sizeof(dist_job))) {
+                    // the job goes back to the queue in drop_worker
+                    dead.push_back(w.first);
+                }
+            }
+            for (int fd : dead) drop_worker(fd);
+            dead.clear();
+        }
+
+        void drop_worker(int fd) {
+            auto it = workers.find(fd);
+            if (it == workers.end()) return;
+            if (it->second.busy) {
+                std::cerr << "coordinator: worker lost, requeueing job " << it->second.job.id << "\n";
+                pending.push_front(it->second.job);
+            }
+            close(fd);
+            workers.erase(it);
+
+            // keep at least one worker alive while there is work left
+            if (workers.empty() && done_jobs < total_jobs) spawn_worker(-1);
+        }
+
+        bool receive(int fd, std::vector<framebuffer>& frames) {
+            dist_result result;
+            if (!read_all(fd, &result, sizeof(result))) return false;
+
+            worker_state& w = workers[fd];
+            const dist_job& job = w.job;
+            const int expected = (job.x1 - job.x0) * (job.y1 - job.y0);
+            if (!w.busy || result.id != job.id || result.pixel_count != expected) return false;
+
+            sums.resize(static_cast<size_t>(expected) * 3);
+            if (!read_all(fd, sums.data(), sums.size() * sizeof(float))) return false;
+
+            framebuffer& fb = frames[job.frame];
+            size_t i = 0;
+            for (int y = job.y0; y < job.y1; y++)
+            for (int x = job.x0; x < job.x1; x++, i += 3) {
+                fb.add(x, y, color(sums[i], sums[i+1], sums[i+2]), job.s1 - job.s0);
+            }
+
+            w.busy = false;
+            done_jobs++;
+            return true;
+        }
+
+        bool event_loop(std::vector<framebuffer>& frames) {
+            int last_percent = -1;
+            while (done_jobs < total_jobs) {
+                std::vector<pollfd> fds;
+                fds.push_back(pollfd{listen_fd, POLLIN, 0});
+                for (auto& w : workers) fds.push_back(pollfd{w.first, POLLIN, 0});
+
+                if (poll(fds.data(), fds.size(), 1000) < 0) {
+                    if (errno == EINTR) continue;
+                    return false;
+                }
+
+                if (fds[0].revents & POLLIN) {
+                    int fd = accept(listen_fd, nullptr, nullptr);
+                    if (fd >= 0) {
+                        workers[fd] = worker_state();
+                        send_config(fd);
+                    }
+                }
+
+                for (size_t i = 1; i < fds.size(); i++) {
+                    if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+                    if (!receive(fds[i].fd, frames)) drop_worker(fds[i].fd);
+                }
+
+                reap_children();
+                dispatch();
+
+                int percent = 100 * done_jobs / std::max(total_jobs, 1);
+                if (percent != last_percent) {
+                    std::cerr << "\rjobs done: " << percent << "% (" << workers.size() << " workers) " << std::flush;
+                    last_percent = percent;
+                }
+            }
+            std::cerr << "\n";
+            return true;
+        }
+
+        void reap_children() {
+            for (size_t i = 0; i < children.size();) {
+                if (waitpid(children[i], nullptr, WNOHANG) > 0) {
+                    children.erase(children.begin() + i);
+                } else {
+                    i++;
+                }
+            }
+        }
+
+    private:
+        dist_settings settings;
+        int listen_fd = -1;
+        std::map<int, worker_state> workers;
+        std::vector<int> dead;
+        std::vector<pid_t> children;
+        std::deque<dist_job> pending;
+        std::vector<float> sums;
+        int total_jobs = 0;
+        int done_jobs = 0;
+};
+
+#endif
@@ -0,0 +1,286 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Reads a PFM (1 or 3 channels, either endianness) into rgb floats, top row first.
+bool read_pfm(const std::string& path, int& width, int& height, std::vector<float>& rgb) {
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) return false;
+
+    char magic[3] = {0, 0, 0};
+    double scale = 0;
+    bool ok = std::fscanf(f, "%2s %d %d %lf", magic, &width, &height, &scale) == 4
+        && magic[0] == 'P' && (magic[1] == 'F' || magic[1] == 'f')
+        && width > 0 && height > 0 && scale != 0;
+    ok = ok && std::fgetc(f) != EOF; // the single whitespace before the pixels
+
+    const int channels = magic[1] == 'F' ? 3 : 1;
+    std::vector<float> data;
+    if (ok) {
+        data.resize(static_cast<size_t>(width) * height * channels);
+        ok = std::fread(data.data(), sizeof(float), data.size(), f) == data.size();
+    }
+    std::fclose(f);
+    if (!ok) return false;
+
+    // a negative scale marks little endian data
+    const uint16_t probe = 1;
+    const bool host_little = *reinterpret_cast<const uint8_t*>(&probe) == 1;
+    if ((scale < 0) != host_little) {
+        for (auto& v : data) {
+            uint8_t* b = reinterpret_cast<uint8_t*>(&v);
+            std::swap(b[0], b[3]);
+            std::swap(b[1], b[2]);
+        }
+    }
+
+    // rows are stored bottom to top
+    rgb.resize(static_cast<size_t>(width) * height * 3);
+    for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++) {
+        const float* src = &data[(static_cast<size_t>(height - 1 - y) * width + x) * channels];
+        float* dst = &rgb[(static_cast<size_t>(y) * width + x) * 3];
+        for (int c = 0; c < 3; c++) dst[c] = src[channels == 3 ? c : 0];
+    }
+    return true;
+}
+
+// Reads a Radiance .hdr (32-bit_rle_rgbe, -Y height +X width) into rgb floats, top row
+// first. Both flat and run length encoded scanlines are understood.
+bool read_hdr(const std::string& path, int& width, int& height, std::vector<float>& rgb) {
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) return false;
+
+    // header lines up to a blank one, then the resolution
+    char line[256];
+    bool format_ok = true;
+    bool ok = std::fgets(line, sizeof(line), f) && std::strncmp(line, "#?", 2) == 0;
+    while (ok) {
+        if (!std::fgets(line, sizeof(line), f)) { ok = false; break; }
+        if (line[0] == '\n') break;
+        if (std::strncmp(line, "FORMAT=", 7) == 0) format_ok = std::strncmp(line + 7, "32-bit_rle_rgbe", 15) == 0;
+    }
+    ok = ok && format_ok && std::fscanf(f, "-Y %d +X %d", &height, &width) == 2 && width > 0 && height > 0;
+    ok = ok && std::fgetc(f) == '\n';
+
+    std::vector<uint8_t> scanline(static_cast<size_t>(width) * 4);
+    if (ok) rgb.resize(static_cast<size_t>(width) * height * 3);
+    for (int y = 0; ok && y < height; y++) {
+        uint8_t head[4];
+        ok = std::fread(head, 1, 4, f) == 4;
+        if (!ok) break;
+
+        if (head[0] == 2 && head[1] == 2 && (head[2] << 8 | head[3]) == width && width >= 8 && width < 32768) {
+            // each of the four components run length encoded in turn
+            for (int c = 0; ok && c < 4; c++) {
+                int x = 0;
+                while (ok && x < width) {
+                    int count = std::fgetc(f);
+                    if (count == EOF || count == 0) { ok = false; break; }
+                    if (count > 128) {
+                        count -= 128;
+                        const int value = std::fgetc(f);
+                        ok = value != EOF && x + count <= width;
+                        for (int i = 0; ok && i < count; i++) scanline[(x++) * 4 + c] = static_cast<uint8_t>(value);
+                    } else {
+                        ok = x + count <= width;
+                        for (int i = 0; ok && i < count; i++) {
+                            const int value = std::fgetc(f);
+                            ok = value != EOF;
+                            scanline[(x++) * 4 + c] = static_cast<uint8_t>(value);
+                        }
+                    }
+                }
+            }
+        } else {
+            // a flat scanline, whose first pixel has already been read
+            std::memcpy(scanline.data(), head, 4);
+            ok = std::fread(scanline.data() + 4, 1, scanline.size() - 4, f) == scanline.size() - 4;
+        }
+
+        for (int x = 0; ok && x < width; x++) {
+            const uint8_t* p = &scanline[x * 4];
+            const float scale = p[3] ? std::ldexp(1.0f, p[3] - 136) : 0.0f;
+            float* dst = &rgb[(static_cast<size_t>(y) * width + x) * 3];
+            for (int c = 0; c < 3; c++) dst[c] = p[c] * scale;
+        }
+    }
+    std::fclose(f);
+    return ok;
+}
+
+// Walker's alias method: picks index i of n with probability weight[i] / sum in constant
+// time from one uniform number. Each slot keeps the chance of staying and the index to
+// go to otherwise, 8 bytes per entry.
+class alias_table {
+    public:
+        alias_table() {}
+
+        // Returns false, and samples nothing, when the weights sum to zero.
+        bool build(const float* weight, uint32_t n);
+
+        uint32_t sample(double u) const {
+            const double scaled = u * slots.size();
+            uint32_t i = static_cast<uint32_t>(scaled);
+            if (i >= slots.size()) i = static_cast<uint32_t>(slots.size()) - 1;
+            return scaled - i < slots[i].stay ? i : slots[i].alias;
+        }
+
+        double total() const { return sum; }
+
+    private:
+        struct slot {
+            float stay;
+            uint32_t alias;
+        };
+
+        std::vector<slot> slots;
+        double sum = 0;
+};
+
+bool alias_table::build(const float* weight, uint32_t n) {
+    sum = 0;
+    for (uint32_t i = 0; i < n; i++) sum += weight[i];
+    slots.assign(n, slot{1.0f, 0});
+    for (uint32_t i = 0; i < n; i++) slots[i].alias = i;
+    if (sum <= 0) return false;
+
+    // Vose's variant: pair every under-full slot with one that has weight to spare
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> small, large;
+    for (uint32_t i = 0; i < n; i++) {
+        scaled[i] = weight[i] * n / sum;
+        (scaled[i] < 1 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+        const uint32_t s = small.back(), l = large.back();
+        small.pop_back();
+        slots[s].stay = static_cast<float>(scaled[s]);
+        slots[s].alias = l;
+        scaled[l] -= 1 - scaled[s];
+        if (scaled[l] < 1) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // what is left is full up to rounding
+    for (uint32_t i : small) slots[i].stay = 1.0f;
+    for (uint32_t i : large) slots[i].stay = 1.0f;
+    return true;
+}
+
+// A latitude-longitude image of the light arriving from every direction, used as the
+// background and as a light. The top row looks along +y and the centre column along -z.
+//
+// Directions are importance sampled from a piecewise constant distribution over the
+// pixels, in proportion to their luminance times the solid angle they cover: an alias
+// table picks a row, and the row's own table picks a pixel in it.
+class environment_map {
+    public:
+        environment_map() {}
+
+        // Loads a .pfm or .hdr image, with every value multiplied by scale.
+        bool load(const std::string& path, double scale = 1.0);
+
+        bool loaded() const { return width > 0; }
+
+        color eval(const vec3& direction) const {
+            if (!loaded()) return color(0,0,0);
+            const size_t i = pixel(direction);
+            return color(texels[i * 3], texels[i * 3 + 1], texels[i * 3 + 2]);
+        }
+
+        // A direction picked in proportion to the light arriving from it, with its solid
+        // angle density. pdf is 0 for a map that is black everywhere.
+        vec3 sample(double& pdf) const;
+
+        double pdf(const vec3& direction) const {
+            if (!can_sample) return 0;
+            // uniform over the pixel in (u, v), which is (2 pi, pi) in angles
+            const vec3 d = unit_vector(direction);
+            const double sin_theta = sqrt(fmax(0.0, 1 - d.y() * d.y()));
+            if (sin_theta <= 0) return 0;
+            return weight[pixel(d)] / total * width * height / (2 * pi * pi * sin_theta);
+        }
+
+    private:
+        size_t pixel(const vec3& direction) const {
+            const vec3 d = unit_vector(direction);
+            const double u = (std::atan2(d.x(), -d.z()) + pi) / (2 * pi);
+            const double v = std::acos(clamp(d.y(), -1.0, 1.0)) / pi;
+            const int x = std::min(static_cast<int>(u * width), width - 1);
+            const int y = std::min(static_cast<int>(v * height), height - 1);
+            return static_cast<size_t>(y) * width + x;
+        }
+
+    private:
+        int width = 0, height = 0;
+        std::vector<float> texels;   // rgb, top row first
+        std::vector<float> weight;   // luminance times sin(theta) of each pixel
+        double total = 0;
+        alias_table rows;
+        std::vector<alias_table> columns;
+        bool can_sample = false;
+};
+
+bool environment_map::load(const std::string& path, double scale) {
+    const bool is_hdr = path.size() >= 4 && path.compare(path.size() - 4, 4, ".hdr") == 0;
+    const bool ok = is_hdr ? read_hdr(path, width, height, texels) : read_pfm(path, width, height, texels);
+    if (!ok) {
+        std::cerr << "Could not load environment map '" << path << "'.\n";
+        width = height = 0;
+        texels.clear();
+        return false;
+    }
+    for (auto& t : texels) t = static_cast<float>(t * scale);
+
+    weight.resize(static_cast<size_t>(width) * height);
+    std::vector<float> row_sums(height);
+    columns.assign(height, alias_table());
+    for (int y = 0; y < height; y++) {
+        const double sin_theta = std::sin(pi * (y + 0.5) / height);
+        for (int x = 0; x < width; x++) {
+            const size_t i = static_cast<size_t>(y) * width + x;
+            const float* t = &texels[i * 3];
+            // skip negative and non-finite texels, which have no valid density
+            const double lum = 0.2126 * t[0] + 0.7152 * t[1] + 0.0722 * t[2];
+            weight[i] = std::isfinite(lum) && lum > 0 ? static_cast<float>(lum * sin_theta) : 0.0f;
+        }
+        columns[y].build(&weight[static_cast<size_t>(y) * width], width);
+        row_sums[y] = static_cast<float>(columns[y].total());
+    }
+    can_sample = rows.build(row_sums.data(), height);
+    total = rows.total();
+    return true;
+}
+
+vec3 environment_map::sample(double& pdf) const {
+    if (!can_sample) {
+        pdf = 0;
+        return vec3(0, 1, 0);
+    }
+    const uint32_t y = rows.sample(random_double());
+    const uint32_t x = columns[y].sample(random_double());
+
+    // uniform over the pixel's rectangle in (u, v)
+    const double u = (x + random_double()) / width;
+    const double v = (y + random_double()) / height;
+    const double phi = 2 * pi * u - pi;
+    const double theta = pi * v;
+    const vec3 d(std::sin(theta) * std::sin(phi), std::cos(theta), -std::sin(theta) * std::cos(phi));
+
+    pdf = this->pdf(d);
+    return d;
+}
+
+#endif
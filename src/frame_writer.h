@@ -0,0 +1,161 @@
+#ifndef FRAME_WRITER_H
+#define FRAME_WRITER_H
+
+#include "framebuffer.h"
+#include "trace.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Encodes finished frames on a small pool of background threads, so rendering
+// the next frame doesn't wait for the previous one to be written.
+//
+// Frames either go to their own file in the chosen format, or are streamed as
+// raw rgb24 into the stdin of a command (for example an ffmpeg invocation from
+// ffmpeg_pipe_command, or "cat > some_fifo"). Piped frames are written in frame
+// order no matter in which order they were submitted, and have to be numbered from
+// 0 without gaps.
+class frame_writer {
+    public:
+        frame_writer(image_format f, int threads = 2, size_t queue_size = 4)
+            : format(f), max_queued(queue_size)
+        {
+            start(threads);
+        }
+
+        frame_writer(const std::string& pipe_command, int threads = 2, size_t queue_size = 4)
+            : format(FORMAT_PPM), max_queued(queue_size)
+        {
+            pipe = popen(pipe_command.c_str(), "w");
+            if (!pipe) std::cerr << "Could not start '" << pipe_command << "'\n";
+            start(threads);
+        }
+
+        ~frame_writer() {
+            finish();
+        }
+
+        frame_writer(const frame_writer&) = delete;
+        frame_writer& operator=(const frame_writer&) = delete;
+
+        // Queues a frame for encoding. path is the output file without extension and is
+        // ignored when piping. Blocks while the queue is full, and when piping also while
+        // frame is queue_size or more frames ahead of the next one to be written, so
+        // frames that finished early can't pile up behind a slow one.
+        void submit(size_t frame, framebuffer fb, const std::string& path) {
+            if (pipe) {
+                std::unique_lock<std::mutex> lock(pipe_mutex);
+                frame_piped.wait(lock, [&] { return frame < next_frame + max_queued; });
+            }
+
+            std::unique_lock<std::mutex> lock(m);
+            not_full.wait(lock, [&] { return queue.size() < max_queued; });
+            queue.push_back(job{frame, std::move(fb), path});
+            not_empty.notify_one();
+        }
+
+        // Waits until every queued frame is written and stops the workers.
+        void finish() {
+            {
+                std::lock_guard<std::mutex> lock(m);
+                if (closing) return;
+                closing = true;
+            }
+            not_empty.notify_all();
+            for (auto& t : workers) t.join();
+
+            if (pipe) {
+                if (!encoded.empty()) {
+                    std::cerr << "frame_writer: " << encoded.size() << " frames after missing frame " << next_frame << " were not piped\n";
+                }
+                pclose(pipe);
+                pipe = nullptr;
+            }
+        }
+
+    private:
+        struct job {
+            size_t frame;
+            framebuffer fb;
+            std::string path;
+        };
+
+        void start(int threads) {
+            for (int i = 0; i < threads; i++) {
+                workers.emplace_back([this, i] {
+                    trace_thread_name("writer " + std::to_string(i));
+                    worker();
+                });
+            }
+        }
+
+        void worker() {
+            while (true) {
+                job j;
+                {
+                    std::unique_lock<std::mutex> lock(m);
+                    not_empty.wait(lock, [&] { return closing || !queue.empty(); });
+                    if (queue.empty()) return;
+                    j = std::move(queue.front());
+                    queue.pop_front();
+                    not_full.notify_one();
+                }
+
+                trace_span span("encode", "io", static_cast<int>(j.frame));
+                if (pipe) {
+                    write_piped(j);
+                } else if (!write_image(j.path + image_extension(format), j.fb, format)) {
+                    std::cerr << "Could not write " << j.path << image_extension(format) << "\n";
+                }
+            }
+        }
+
+        void write_piped(job& j) {
+            std::vector<uint8_t> pixels;
+            j.fb.to_rgb8(pixels);
+
+            // whoever completes the next frame in line also flushes the ones queued up behind it
+            std::lock_guard<std::mutex> lock(pipe_mutex);
+            encoded[j.frame] = std::move(pixels);
+            const size_t first = next_frame;
+            for (auto it = encoded.find(next_frame); it != encoded.end(); it = encoded.find(next_frame)) {
+                std::fwrite(it->second.data(), 1, it->second.size(), pipe);
+                encoded.erase(it);
+                next_frame++;
+            }
+            if (next_frame != first) frame_piped.notify_all();
+        }
+
+    private:
+        image_format format;
+        size_t max_queued;
+        std::FILE* pipe = nullptr;
+
+        std::mutex m;
+        std::condition_variable not_empty;
+        std::condition_variable not_full;
+        std::deque<job> queue;
+        bool closing = false;
+        std::vector<std::thread> workers;
+
+        std::mutex pipe_mutex;
+        std::condition_variable frame_piped;
+        // frames encoded ahead of next_frame, fewer than max_queued thanks to submit
+        std::map<size_t, std::vector<uint8_t>> encoded;
+        size_t next_frame = 0;
+};
+
+// Command line for a frame_writer that turns the piped frames into an H.264 video.
+std::string ffmpeg_pipe_command(int width, int height, int fps, const std::string& output) {
+    return "ffmpeg -loglevel error -f rawvideo -pix_fmt rgb24 -s " + std::to_string(width) + "x" + std::to_string(height)
+        + " -r " + std::to_string(fps) + " -i - -c:v libx264 -pix_fmt yuv420p " + output + " -y";
+}
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "rtweekend.h"
+
+#include "color.h"
+#include "qoi.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+enum image_format {
+    FORMAT_PPM,     // binary P6, 8 bit gamma corrected
+    FORMAT_PPM16,   // binary P6, 16 bit gamma corrected
+    FORMAT_PFM,     // linear 32 bit float
+    FORMAT_EXR,     // linear 16 bit half float, uncompressed OpenEXR
+    FORMAT_QOI      // lossless compressed 8 bit, gamma corrected
+};
+
+inline const char* image_extension(image_format format) {
+    switch (format) {
+        case FORMAT_PPM: return ".ppm";
+        case FORMAT_PPM16: return ".ppm";
+        case FORMAT_PFM: return ".pfm";
+        case FORMAT_EXR: return ".exr";
+        case FORMAT_QOI: return ".qoi";
+    }
+    return "";
+}
+
+// The format named on a command line: ppm, ppm16, pfm, exr or qoi.
+inline bool parse_format(const std::string& name, image_format& format) {
+    if (name == "ppm") format = FORMAT_PPM;
+    else if (name == "ppm16") format = FORMAT_PPM16;
+    else if (name == "pfm") format = FORMAT_PFM;
+    else if (name == "exr") format = FORMAT_EXR;
+    else if (name == "qoi") format = FORMAT_QOI;
+    else return false;
+    return true;
+}
+
+// Accumulated radiance of a frame. Every pixel stores the sum of its samples and
+// the number of samples taken, rows go from the bottom (y = 0) to the top.
+class framebuffer {
+    public:
+        framebuffer() {}
+        framebuffer(int w, int h)
+            : width(w), height(h), rgb(static_cast<size_t>(w) * h * 3, 0.0f), samples(static_cast<size_t>(w) * h, 0.0f) {}
+
+        inline void add(int x, int y, const color& sum, int sample_count) {
+            const size_t pos = static_cast<size_t>(y) * width + x;
+            rgb[pos*3 + 0] += static_cast<float>(sum.x());
+            rgb[pos*3 + 1] += static_cast<float>(sum.y());
+            rgb[pos*3 + 2] += static_cast<float>(sum.z());
+            samples[pos] += static_cast<float>(sample_count);
+        }
+
+        size_t pixel_count() const { return static_cast<size_t>(width) * height; }
+
+        // 1 / sample count for every pixel, 0 for pixels without samples.
+        std::vector<float> sample_scale() const {
+            std::vector<float> scale(pixel_count());
+            for (size_t i = 0; i < scale.size(); i++) {
+                scale[i] = samples[i] > 0 ? 1.0f / samples[i] : 0.0f;
+            }
+            return scale;
+        }
+
+        // Gamma corrected 8 bit RGB, rows from top to bottom as image viewers expect.
+        void to_rgb8(std::vector<uint8_t>& out) const {
+            std::vector<uint8_t> bottom_up(pixel_count() * 3);
+            tonemap_8bit(rgb.data(), sample_scale().data(), bottom_up.data(), pixel_count());
+            out.resize(bottom_up.size());
+            flip_rows(bottom_up.data(), out.data(), width * 3);
+        }
+
+        template<typename T>
+        void flip_rows(const T* in, T* out, size_t row_length) const {
+            for (int y = 0; y < height; y++) {
+                std::copy(in + row_length * y, in + row_length * (y + 1), out + row_length * (height - 1 - y));
+            }
+        }
+
+    public:
+        int width = 0;
+        int height = 0;
+        std::vector<float> rgb;
+        std::vector<float> samples;
+};
+
+// Writes the whole buffer with a single call.
+bool write_file(const std::string& path, const std::vector<char>& bytes) {
+    std::FILE* f = std::fopen(path.c_str(), "wb");
+    if (!f) return false;
+    bool ok = std::fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    return std::fclose(f) == 0 && ok;
+}
+
+inline void append_bytes(std::vector<char>& bytes, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    bytes.insert(bytes.end(), p, p + size);
+}
+
+inline void append_string(std::vector<char>& bytes, const std::string& s) {
+    append_bytes(bytes, s.data(), s.size());
+}
+
+// Writes a 1 or 3 channel float image as PFM. Rows are expected bottom to top,
+// which is the order PFM stores them in.
+bool write_pfm(const std::string& path, const float* data, int width, int height, int channels) {
+    std::vector<char> bytes;
+    // a negative scale marks the data as little endian
+    append_string(bytes, std::string(channels == 3 ? "PF" : "Pf") + "\n"
+        + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n");
+    append_bytes(bytes, data, sizeof(float) * width * height * channels);
+    return write_file(path, bytes);
+}
+
+bool write_ppm(const std::string& path, const framebuffer& fb) {
+    std::vector<uint8_t> pixels;
+    fb.to_rgb8(pixels);
+
+    std::vector<char> bytes;
+    append_string(bytes, "P6\n" + std::to_string(fb.width) + " " + std::to_string(fb.height) + "\n255\n");
+    append_bytes(bytes, pixels.data(), pixels.size());
+    return write_file(path, bytes);
+}
+
+bool write_ppm16(const std::string& path, const framebuffer& fb) {
+    std::vector<uint16_t> bottom_up(fb.pixel_count() * 3);
+    tonemap_16bit(fb.rgb.data(), fb.sample_scale().data(), bottom_up.data(), fb.pixel_count());
+
+    std::vector<uint16_t> pixels(bottom_up.size());
+    fb.flip_rows(bottom_up.data(), pixels.data(), fb.width * 3);
+    // 16 bit PPM samples are big endian
+    for (auto& p : pixels) p = static_cast<uint16_t>((p >> 8) | (p << 8));
+
+    std::vector<char> bytes;
+    append_string(bytes, "P6\n" + std::to_string(fb.width) + " " + std::to_string(fb.height) + "\n65535\n");
+    append_bytes(bytes, pixels.data(), pixels.size() * sizeof(uint16_t));
+    return write_file(path, bytes);
+}
+
+bool write_pfm(const std::string& path, const framebuffer& fb) {
+    std::vector<float> linear(fb.pixel_count() * 3);
+    scale_linear(fb.rgb.data(), fb.sample_scale().data(), linear.data(), fb.pixel_count());
+    return write_pfm(path, linear.data(), fb.width, fb.height, 3);
+}
+
+// Minimal scanline OpenEXR writer: half float B, G, R channels, no compression.
+bool write_exr(const std::string& path, const framebuffer& fb) {
+    std::vector<float> linear(fb.pixel_count() * 3);
+    scale_linear(fb.rgb.data(), fb.sample_scale().data(), linear.data(), fb.pixel_count());
+
+    std::vector<char> bytes;
+    auto put_i32 = [&](int32_t v) { append_bytes(bytes, &v, 4); };
+    auto put_attr = [&](const std::string& name, const std::string& type, int32_t size) {
+        append_bytes(bytes, name.c_str(), name.size() + 1);
+        append_bytes(bytes, type.c_str(), type.size() + 1);
+        put_i32(size);
+    };
+
+    const int32_t magic = 20000630;
+    put_i32(magic);
+    put_i32(2); // version 2, single part scanline file
+
+    // channels are stored in alphabetical order
+    const char channel_names[3] = {'B', 'G', 'R'};
+    put_attr("channels", "chlist", 3 * 18 + 1);
+    for (char c : channel_names) {
+        append_bytes(bytes, &c, 1);
+        bytes.push_back('\0');
+        put_i32(1);                 // HALF
+        bytes.insert(bytes.end(), 4, '\0'); // pLinear + reserved
+        put_i32(1);                 // x sampling
+        put_i32(1);                 // y sampling
+    }
+    bytes.push_back('\0');
+
+    put_attr("compression", "compression", 1);
+    bytes.push_back('\0');
+
+    const int32_t window[4] = {0, 0, fb.width - 1, fb.height - 1};
+    put_attr("dataWindow", "box2i", 16);
+    append_bytes(bytes, window, 16);
+    put_attr("displayWindow", "box2i", 16);
+    append_bytes(bytes, window, 16);
+
+    put_attr("lineOrder", "lineOrder", 1);
+    bytes.push_back('\0');
+
+    const float one = 1.0f;
+    const float center[2] = {0.0f, 0.0f};
+    put_attr("pixelAspectRatio", "float", 4);
+    append_bytes(bytes, &one, 4);
+    put_attr("screenWindowCenter", "v2f", 8);
+    append_bytes(bytes, center, 8);
+    put_attr("screenWindowWidth", "float", 4);
+    append_bytes(bytes, &one, 4);
+    bytes.push_back('\0');
+
+    // one chunk per scanline, the offset table comes right after the header
+    const int32_t line_size = fb.width * 3 * 2;
+    const uint64_t table_end = bytes.size() + sizeof(uint64_t) * fb.height;
+    for (int y = 0; y < fb.height; y++) {
+        uint64_t offset = table_end + static_cast<uint64_t>(y) * (8 + line_size);
+        append_bytes(bytes, &offset, 8);
+    }
+
+    std::vector<uint16_t> line(fb.width * 3);
+    for (int y = 0; y < fb.height; y++) {
+        // exr rows go top to bottom
+        const float* row = &linear[static_cast<size_t>(fb.height - 1 - y) * fb.width * 3];
+        for (int c = 0; c < 3; c++) {
+            const int source_channel = 2 - c;
+            for (int x = 0; x < fb.width; x++) {
+                line[c * fb.width + x] = float_to_half(row[x*3 + source_channel]);
+            }
+        }
+        put_i32(y);
+        put_i32(line_size);
+        append_bytes(bytes, line.data(), line_size);
+    }
+
+    return write_file(path, bytes);
+}
+
+bool write_qoi(const std::string& path, const framebuffer& fb) {
+    std::vector<uint8_t> pixels;
+    fb.to_rgb8(pixels);
+
+    std::vector<char> bytes;
+    encode_qoi(pixels.data(), fb.width, fb.height, bytes);
+    return write_file(path, bytes);
+}
+
+bool write_image(const std::string& path, const framebuffer& fb, image_format format) {
+    switch (format) {
+        case FORMAT_PPM: return write_ppm(path, fb);
+        case FORMAT_PPM16: return write_ppm16(path, fb);
+        case FORMAT_PFM: return write_pfm(path, fb);
+        case FORMAT_EXR: return write_exr(path, fb);
+        case FORMAT_QOI: return write_qoi(path, fb);
+    }
+    return false;
+}
+
+#endif
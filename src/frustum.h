@@ -0,0 +1,100 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <vector>
+
+// The pyramid of camera rays through a rectangle of the image, all leaving one point.
+// Its four sides are planes through the apex with normals pointing inwards.
+struct frustum {
+    point3 apex;
+    vec3 forward;   // towards the rectangle's centre
+    vec3 normal[4];
+    int axis_sign[3]; // 1 or -1 when every ray goes that way along the axis, or 0
+
+    // Builds the pyramid through four corner directions, given in order around the
+    // rectangle.
+    frustum(const point3& origin, const vec3 corner[4]) : apex(origin) {
+        forward = unit_vector(corner[0] + corner[1] + corner[2] + corner[3]);
+        for (int i = 0; i < 4; i++) {
+            normal[i] = cross(corner[i], corner[(i + 1) % 4]);
+            if (dot(normal[i], forward) < 0) normal[i] = -normal[i];
+        }
+        for (int a = 0; a < 3; a++) {
+            bool up = true, down = true;
+            for (int i = 0; i < 4; i++) {
+                up = up && corner[i][a] >= 0;
+                down = down && corner[i][a] <= 0;
+            }
+            axis_sign[a] = up ? 1 : (down ? -1 : 0);
+        }
+    }
+
+    // False only when no point of box can be reached by a ray of the pyramid: the box
+    // lies entirely outside one of the sides, behind the apex, or on the other side of the
+    // apex along an axis all rays go one way on. The last catches large boxes, like the
+    // ground, that reach into every side's half-space without meeting the pyramid.
+    bool overlaps(const aabb& box) const {
+        for (int a = 0; a < 3; a++) {
+            if (axis_sign[a] > 0 && box.max()[a] < apex[a]) return false;
+            if (axis_sign[a] < 0 && box.min()[a] > apex[a]) return false;
+        }
+        auto outside = [&](const vec3& n) {
+            // the corner of the box furthest along n
+            vec3 p;
+            for (int a = 0; a < 3; a++) p[a] = (n[a] >= 0 ? box.max()[a] : box.min()[a]) - apex[a];
+            return dot(n, p) < 0;
+        };
+        for (int i = 0; i < 4; i++) {
+            if (outside(normal[i])) return false;
+        }
+        return !outside(forward);
+    }
+};
+
+// Adds to out the objects below node whose boxes over the shutter [time0, time1] overlap
+// f, walking down through lists and bvh nodes. Returns false as soon as there would be
+// more than limit of them, leaving out partly filled.
+bool frustum_candidates(const hittable& node, const frustum& f, double time0, double time1, size_t limit,
+    std::vector<shared_ptr<hittable>>& out);
+
+inline bool frustum_visit(const shared_ptr<hittable>& object, const frustum& f, double time0, double time1, size_t limit,
+    std::vector<shared_ptr<hittable>>& out)
+{
+    aabb box;
+    // objects without a box can be anywhere
+    if (object->bounding_box(time0, time1, box) && !f.overlaps(box)) return true;
+
+    if (dynamic_cast<const bvh_node*>(object.get()) || dynamic_cast<const hittable_list*>(object.get())) {
+        return frustum_candidates(*object, f, time0, time1, limit, out);
+    }
+    if (out.size() >= limit) return false;
+    out.push_back(object);
+    return true;
+}
+
+bool frustum_candidates(const hittable& node, const frustum& f, double time0, double time1, size_t limit,
+    std::vector<shared_ptr<hittable>>& out)
+{
+    if (const bvh_node* b = dynamic_cast<const bvh_node*>(&node)) {
+        if (!frustum_visit(b->left, f, time0, time1, limit, out)) return false;
+        return b->left == b->right || frustum_visit(b->right, f, time0, time1, limit, out);
+    }
+    if (const hittable_list* l = dynamic_cast<const hittable_list*>(&node)) {
+        for (const auto& object : l->objects) {
+            if (!frustum_visit(object, f, time0, time1, limit, out)) return false;
+        }
+        return true;
+    }
+    // a single object as the root, which can't be shared: only culled when it is missed
+    aabb box;
+    return node.bounding_box(time0, time1, box) && !f.overlaps(box);
+}
+
+#endif
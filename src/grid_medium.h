@@ -0,0 +1,218 @@
+#ifndef GRID_MEDIUM_H
+#define GRID_MEDIUM_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "material.h"
+
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Heterogeneous participating medium: a voxel grid of densities filling an axis
+// aligned box, sampled with delta tracking.
+//
+// Next to the voxels the medium keeps a coarse majorant grid holding the largest
+// density of every block of block_size^3 voxels. A ray walks the blocks it crosses
+// and only takes tentative collisions inside them with the local majorant, so empty
+// blocks cost one step and thin regions need few density lookups. The medium has a
+// tight bounding box and is found through the scene BVH like any other object.
+class grid_medium : public hittable {
+    public:
+        // densities holds nx * ny * nz values with x varying fastest, each multiplied by scale.
+        grid_medium(const point3& box_min, const point3& box_max, int nx, int ny, int nz,
+            const std::vector<float>& densities, double scale, color albedo);
+
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+            output_box = aabb(minimum, maximum);
+            return true;
+        }
+
+        // Trilinearly interpolated density at p.
+        double density(const point3& p) const;
+
+    public:
+        static const int block_size = 8;
+
+    private:
+        bool clip(const ray& r, double t_min, double t_max, double& t0, double& t1) const;
+
+        float voxel(int x, int y, int z) const {
+            x = x < 0 ? 0 : (x >= n[0] ? n[0] - 1 : x);
+            y = y < 0 ? 0 : (y >= n[1] ? n[1] - 1 : y);
+            z = z < 0 ? 0 : (z >= n[2] ? n[2] - 1 : z);
+            return grid[(static_cast<size_t>(z) * n[1] + y) * n[0] + x];
+        }
+
+    private:
+        point3 minimum;
+        point3 maximum;
+        int n[3];
+        int blocks[3];
+        std::vector<float> grid;
+        std::vector<float> majorants;
+        shared_ptr<material> phase_function;
+};
+
+grid_medium::grid_medium(const point3& box_min, const point3& box_max, int nx, int ny, int nz,
+    const std::vector<float>& densities, double scale, color albedo)
+    : minimum(box_min), maximum(box_max), n{nx, ny, nz},
+      grid(densities), phase_function(make_shared<isotropic>(albedo))
+{
+    for (auto& d : grid) d = static_cast<float>(d * scale);
+    if (grid.size() != static_cast<size_t>(nx) * ny * nz) {
+        std::cerr << "grid_medium: expected " << nx * ny * nz << " densities, got " << grid.size() << "\n";
+        grid.assign(static_cast<size_t>(nx) * ny * nz, 0.0f);
+    }
+
+    for (int a = 0; a < 3; a++) blocks[a] = (n[a] + block_size - 1) / block_size;
+    majorants.assign(static_cast<size_t>(blocks[0]) * blocks[1] * blocks[2], 0.0f);
+
+    // Interpolating inside a block also reads the voxel just outside of it on each side.
+    for (int bz = 0; bz < blocks[2]; bz++)
+    for (int by = 0; by < blocks[1]; by++)
+    for (int bx = 0; bx < blocks[0]; bx++) {
+        float m = 0.0f;
+        for (int z = bz * block_size - 1; z <= (bz + 1) * block_size; z++)
+        for (int y = by * block_size - 1; y <= (by + 1) * block_size; y++)
+        for (int x = bx * block_size - 1; x <= (bx + 1) * block_size; x++) {
+            m = fmax(m, voxel(x, y, z));
+        }
+        majorants[(static_cast<size_t>(bz) * blocks[1] + by) * blocks[0] + bx] = m;
+    }
+}
+
+double grid_medium::density(const point3& p) const {
+    double g[3];
+    int i[3];
+    for (int a = 0; a < 3; a++) {
+        g[a] = (p[a] - minimum[a]) / (maximum[a] - minimum[a]) * n[a] - 0.5;
+        i[a] = static_cast<int>(std::floor(g[a]));
+        g[a] -= i[a];
+    }
+
+    double d = 0.0;
+    for (int c = 0; c < 8; c++) {
+        const int dx = c & 1, dy = (c >> 1) & 1, dz = c >> 2;
+        const double w = (dx ? g[0] : 1 - g[0]) * (dy ? g[1] : 1 - g[1]) * (dz ? g[2] : 1 - g[2]);
+        d += w * voxel(i[0] + dx, i[1] + dy, i[2] + dz);
+    }
+    return d;
+}
+
+// Slab test against the box, narrowing [t_min, t_max] to the part inside it.
+bool grid_medium::clip(const ray& r, double t_min, double t_max, double& t0, double& t1) const {
+    t0 = t_min;
+    t1 = t_max;
+    for (int a = 0; a < 3; a++) {
+        const double inv_d = 1.0 / r.direction()[a];
+        double near = (minimum[a] - r.origin()[a]) * inv_d;
+        double far = (maximum[a] - r.origin()[a]) * inv_d;
+        if (inv_d < 0) std::swap(near, far);
+        t0 = near > t0 ? near : t0;
+        t1 = far < t1 ? far : t1;
+        if (t1 <= t0) return false;
+    }
+    return true;
+}
+
+bool grid_medium::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    STAT_PRIMITIVE(PRIM_MEDIUM);
+
+    double t0, t1;
+    if (!clip(r, t_min, t_max, t0, t1)) return false;
+
+    const double ray_length = r.direction().length();
+
+    // 3D DDA over the majorant blocks, in block coordinates
+    int cell[3], step[3];
+    double next_t[3], delta_t[3];
+    const point3 start = r.at(t0);
+    for (int a = 0; a < 3; a++) {
+        const double scale = n[a] / ((maximum[a] - minimum[a]) * block_size);
+        const double pos = (start[a] - minimum[a]) * scale;
+        const double dir = r.direction()[a] * scale;
+        cell[a] = static_cast<int>(pos);
+        cell[a] = cell[a] < 0 ? 0 : (cell[a] >= blocks[a] ? blocks[a] - 1 : cell[a]);
+
+        if (dir > 0) {
+            step[a] = 1;
+            next_t[a] = t0 + (cell[a] + 1 - pos) / dir;
+            delta_t[a] = 1 / dir;
+        } else if (dir < 0) {
+            step[a] = -1;
+            next_t[a] = t0 + (cell[a] - pos) / dir;
+            delta_t[a] = -1 / dir;
+        } else {
+            step[a] = 0;
+            next_t[a] = infinity;
+            delta_t[a] = infinity;
+        }
+    }
+
+    double t = t0;
+    while (true) {
+        const int axis = next_t[0] < next_t[1]
+            ? (next_t[0] < next_t[2] ? 0 : 2)
+            : (next_t[1] < next_t[2] ? 1 : 2);
+        const double cell_exit = fmin(next_t[axis], t1);
+        const double majorant = majorants[(static_cast<size_t>(cell[2]) * blocks[1] + cell[1]) * blocks[0] + cell[0]];
+
+        // Delta tracking against the block's majorant. Free paths are memoryless, so
+        // a path leaving the block simply restarts in the next one.
+        if (majorant > 0) {
+            while (true) {
+                t -= std::log(1 - random_double()) / (majorant * ray_length);
+                if (t >= cell_exit) break;
+
+                if (density(r.at(t)) > random_double() * majorant) {
+                    rec.t = t;
+                    rec.p = r.at(t);
+                    rec.normal = vec3(1,0,0);  // arbitrary
+                    rec.front_face = true;     // also arbitrary
+                    rec.mat_ptr = phase_function;
+                    return true;
+                }
+            }
+        }
+
+        t = cell_exit;
+        if (cell_exit >= t1) return false;
+        cell[axis] += step[axis];
+        if (cell[axis] < 0 || cell[axis] >= blocks[axis]) return false;
+        next_t[axis] += delta_t[axis];
+    }
+}
+
+// Reads nx * ny * nz little endian float32 densities, x varying fastest.
+bool load_raw_density(const std::string& path, int nx, int ny, int nz, std::vector<float>& out) {
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) {
+        std::cerr << "Could not open " << path << "\n";
+        return false;
+    }
+    out.resize(static_cast<size_t>(nx) * ny * nz);
+    const bool ok = std::fread(out.data(), sizeof(float), out.size(), f) == out.size();
+    std::fclose(f);
+    if (!ok) std::cerr << path << " is smaller than " << nx << "x" << ny << "x" << nz << " floats\n";
+    return ok;
+}
+
+// Evaluates f at the voxel centres, given in [0,1]^3 box coordinates.
+std::vector<float> procedural_density(int nx, int ny, int nz, const std::function<double(const point3&)>& f) {
+    std::vector<float> out;
+    out.reserve(static_cast<size_t>(nx) * ny * nz);
+    for (int z = 0; z < nz; z++)
+    for (int y = 0; y < ny; y++)
+    for (int x = 0; x < nx; x++) {
+        out.push_back(static_cast<float>(f(point3((x + 0.5) / nx, (y + 0.5) / ny, (z + 0.5) / nz))));
+    }
+    return out;
+}
+
+#endif
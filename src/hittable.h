@@ -14,6 +14,9 @@ struct hit_record {
     double u;
     double v;
     bool front_face;
+    int object_id = -1; // index of the hit object among the scene's top-level objects
+    double uv_scale = 0;     // uv units per unit of surface length, 0 when u and v are unused
+    double uv_footprint = 0; // width of the ray's footprint in uv units
 
     inline void set_face_normal(const ray& r, const vec3& outward_normal) {
         front_face = dot(r.direction(), outward_normal) < 0;
@@ -21,11 +24,73 @@ struct hit_record {
     }
 };
 
+// The ray parameter ranges spent inside a closed object, sorted and non-overlapping.
+// Fixed capacity, so collecting them never allocates.
+struct ray_intervals {
+    static const int capacity = 8;
+    double t0[capacity];
+    double t1[capacity];
+    int count = 0;
+
+    // Adds [a, b] as a union with the ranges already present. Returns false when
+    // there is no room left.
+    bool add(double a, double b) {
+        if (b <= a) return true;
+
+        int i = 0;
+        while (i < count && t1[i] < a) i++;
+        // merge with every range overlapping [a, b]
+        int j = i;
+        while (j < count && t0[j] <= b) {
+            a = fmin(a, t0[j]);
+            b = fmax(b, t1[j]);
+            j++;
+        }
+        const int new_count = count - (j - i) + 1;
+        if (new_count > capacity) return false;
+
+        // shift the ranges after the merged ones into place
+        const int shift = new_count - count;
+        if (shift > 0) {
+            for (int k = count - 1; k >= j; k--) { t0[k + shift] = t0[k]; t1[k + shift] = t1[k]; }
+        } else if (shift < 0) {
+            for (int k = j; k < count; k++) { t0[k + shift] = t0[k]; t1[k + shift] = t1[k]; }
+        }
+        t0[i] = a;
+        t1[i] = b;
+        count = new_count;
+        return true;
+    }
+};
+
 class hittable {
     public:
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
 
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const = 0;
+
+        // Boxes at time0 and time1 whose linear interpolation contains the object at every
+        // time in between, for bvh nodes that move their bounds with the ray's time.
+        // Objects that don't move use their box for both.
+        virtual bool motion_bounds(double time0, double time1, aabb& box0, aabb& box1) const {
+            if (!bounding_box(time0, time1, box0)) return false;
+            box1 = box0;
+            return true;
+        }
+
+        // Adds the parts of [t_min, t_max] the ray spends inside the object to out, all
+        // in one query. Returns false for objects that don't enclose a volume (or when out
+        // runs full), callers then have to fall back to hit().
+        virtual bool intervals(const ray& r, double t_min, double t_max, ray_intervals& out) const {
+            return false;
+        }
+
+        // Picks a uniformly distributed point on the surface and fills in its position,
+        // outward normal, uv and material, for emitting light from it. area is the total
+        // surface area. Returns false for objects that can't be sampled.
+        virtual bool sample_surface(hit_record& rec, double& area) const {
+            return false;
+        }
 };
 
 class translate : public hittable {
@@ -38,13 +103,24 @@ class translate : public hittable {
 
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 
+        virtual bool motion_bounds(double time0, double time1, aabb& box0, aabb& box1) const override {
+            if (!ptr->motion_bounds(time0, time1, box0, box1)) return false;
+            box0 = aabb(box0.min() + offset, box0.max() + offset);
+            box1 = aabb(box1.min() + offset, box1.max() + offset);
+            return true;
+        }
+
+        virtual bool intervals(const ray& r, double t_min, double t_max, ray_intervals& out) const override {
+            return ptr->intervals(ray(r.origin() - offset, r.direction(), r.time()), t_min, t_max, out);
+        }
+
     public:
         shared_ptr<hittable> ptr;
         vec3 offset;
 };
 
 bool translate::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    ray moved_r(r.origin() - offset, r.direction());
+    ray moved_r(r.origin() - offset, r.direction(), r.time());
     if (!ptr->hit(moved_r, t_min, t_max, rec))
         return false;
 
@@ -77,6 +153,25 @@ class rotate_y : public hittable {
             return hasbox;
         }
 
+        virtual bool intervals(const ray& r, double t_min, double t_max, ray_intervals& out) const override {
+            return ptr->intervals(rotate(r), t_min, t_max, out);
+        }
+
+    private:
+        // The ray in object space. Only the direction turns, so t is the same in both.
+        ray rotate(const ray& r) const {
+            auto origin = r.origin();
+            auto direction = r.direction();
+
+            origin[0] = cos_theta*r.origin()[0] - sin_theta*r.origin()[2];
+            origin[2] = sin_theta*r.origin()[0] + cos_theta*r.origin()[2];
+
+            direction[0] = cos_theta*r.direction()[0] - sin_theta*r.direction()[2];
+            direction[2] = sin_theta*r.direction()[0] + cos_theta*r.direction()[2];
+
+            return ray(origin, direction, r.time());
+        }
+
     public:
         shared_ptr<hittable> ptr;
         double sin_theta;
@@ -118,16 +213,7 @@ rotate_y::rotate_y(shared_ptr<hittable> p, double angle) : ptr(p) {
 }
 
 bool rotate_y::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    auto origin = r.origin();
-    auto direction = r.direction();
-
-    origin[0] = cos_theta*r.origin()[0] - sin_theta*r.origin()[2];
-    origin[2] = sin_theta*r.origin()[0] + cos_theta*r.origin()[2];
-
-    direction[0] = cos_theta*r.direction()[0] - sin_theta*r.direction()[2];
-    direction[2] = sin_theta*r.direction()[0] + cos_theta*r.direction()[2];
-
-    ray rotated_r(origin, direction);
+    ray rotated_r = rotate(r);
 
     if (!ptr->hit(rotated_r, t_min, t_max, rec))
         return false;
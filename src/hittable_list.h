@@ -25,6 +25,16 @@ class hittable_list : public hittable {
         virtual bool bounding_box(
             double time0, double time1, aabb& output_box) const override;
 
+        virtual bool motion_bounds(double time0, double time1, aabb& box0, aabb& box1) const override;
+
+        // The union of the members' volumes.
+        virtual bool intervals(const ray& r, double t_min, double t_max, ray_intervals& out) const override {
+            for (const auto& object : objects) {
+                if (!object->intervals(r, t_min, t_max, out)) return false;
+            }
+            return true;
+        }
+
     public:
         std::vector<shared_ptr<hittable>> objects;
 };
@@ -44,13 +54,26 @@ bool hittable_list::bounding_box(double time0, double time1, aabb& output_box) c
     return true;
 }
 
+bool hittable_list::motion_bounds(double time0, double time1, aabb& box0, aabb& box1) const {
+    if (objects.empty()) return false;
+
+    aabb b0, b1;
+    for (size_t i = 0; i < objects.size(); i++) {
+        if (!objects[i]->motion_bounds(time0, time1, b0, b1)) return false;
+        box0 = i == 0 ? b0 : surrounding_box(box0, b0);
+        box1 = i == 0 ? b1 : surrounding_box(box1, b1);
+    }
+
+    return true;
+}
+
 bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const{
     hit_record temp_rec;
     bool hit_anything = false;
     auto closest_so_far = t_max;
 
-    for(const auto& object : objects) {
-        if(object->hit(r, t_min, closest_so_far, temp_rec)) {
+    for(int i = 0; i < static_cast<int>(objects.size()); i++) {
+        if(objects[i]->hit(r, t_min, closest_so_far, temp_rec)) {
             hit_anything = true;
             closest_so_far = temp_rec.t;
             rec = temp_rec;
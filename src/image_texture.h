@@ -0,0 +1,197 @@
+#ifndef IMAGE_TEXTURE_H
+#define IMAGE_TEXTURE_H
+
+#include "rtweekend.h"
+
+#include "texture.h"
+#include "texture_cache.h"
+
+#include <cctype>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Reads a binary (P6) PPM with 8 bit channels into linear rgb floats, undoing gamma 2.
+bool read_ppm(const std::string& path, int& width, int& height, std::vector<float>& rgb) {
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) return false;
+
+    // header fields, skipping whitespace and # comments
+    auto field = [&](int& value) {
+        int c = std::fgetc(f);
+        while (c == '#' || std::isspace(c)) {
+            if (c == '#') while (c != '\n' && c != EOF) c = std::fgetc(f);
+            c = std::fgetc(f);
+        }
+        std::ungetc(c, f);
+        return std::fscanf(f, "%d", &value) == 1;
+    };
+
+    char magic[2];
+    int maxval;
+    bool ok = std::fread(magic, 1, 2, f) == 2 && magic[0] == 'P' && magic[1] == '6'
+        && field(width) && field(height) && field(maxval)
+        && width > 0 && height > 0 && maxval == 255;
+    ok = ok && std::fgetc(f) != EOF; // the single whitespace before the pixels
+
+    std::vector<uint8_t> bytes;
+    if (ok) {
+        bytes.resize(static_cast<size_t>(width) * height * 3);
+        ok = std::fread(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    }
+    std::fclose(f);
+    if (!ok) return false;
+
+    rgb.resize(bytes.size());
+    for (size_t i = 0; i < bytes.size(); i++) {
+        const float v = bytes[i] / 255.0f;
+        rgb[i] = v * v;
+    }
+    return true;
+}
+
+// Texture from an image file, stored as a mip pyramid of 8x8 texel tiles that are
+// paged in through texture_cache::global(). Lookups pick the pyramid level from the
+// width of the ray's footprint in uv units and filter trilinearly. u and v wrap.
+class image_texture : public texture {
+    public:
+        image_texture(const std::string& path) {
+            int width, height;
+            std::vector<float> rgb;
+            if (!read_ppm(path, width, height, rgb)) {
+                std::cerr << "Could not load texture image file '" << path << "'.\n";
+                return;
+            }
+            build(width, height, rgb);
+        }
+
+        // from width * height linear rgb texels, rows top down
+        image_texture(int width, int height, std::vector<float> rgb) {
+            build(width, height, std::move(rgb));
+        }
+
+        ~image_texture() {
+            if (tiles.file) std::fclose(tiles.file);
+        }
+
+        image_texture(const image_texture&) = delete;
+        image_texture& operator=(const image_texture&) = delete;
+
+        virtual color value(double u, double v, const point3& p) const override {
+            return value(u, v, p, 0.0);
+        }
+
+        virtual color value(double u, double v, const point3& p, double footprint) const override {
+            // cyan as a debugging aid when the image is missing
+            if (levels.empty()) return color(0,1,1);
+
+            // image rows go top down
+            v = 1.0 - v;
+
+            const double texels = footprint * fmax(levels[0].width, levels[0].height);
+            const double lod = texels > 1.0 ? fmin(std::log2(texels), levels.size() - 1.0) : 0.0;
+            const int lo = static_cast<int>(lod);
+            const double blend = lod - lo;
+
+            color c = bilinear(lo, u, v);
+            if (blend > 0 && lo + 1 < static_cast<int>(levels.size())) {
+                c = (1 - blend) * c + blend * bilinear(lo + 1, u, v);
+            }
+            return c;
+        }
+
+        int level_count() const { return static_cast<int>(levels.size()); }
+
+    private:
+        struct level {
+            int width, height;
+            int tiles_x, tiles_y;
+            uint32_t first_tile;
+        };
+
+        // Builds the pyramid by 2x2 box filtering in linear space and writes every level,
+        // tile by tile, into an anonymous temporary file.
+        void build(int width, int height, std::vector<float> rgb) {
+            tiles.file = std::tmpfile();
+            tiles.id = texture_cache::new_id();
+            if (!tiles.file) {
+                std::cerr << "Could not create the texture tile file.\n";
+                return;
+            }
+
+            uint32_t tile_count = 0;
+            std::vector<uint8_t> tile(tile_bytes);
+            while (true) {
+                level l{width, height, (width + tile_texels - 1) / tile_texels, (height + tile_texels - 1) / tile_texels, tile_count};
+
+                for (int ty = 0; ty < l.tiles_y; ty++)
+                for (int tx = 0; tx < l.tiles_x; tx++) {
+                    for (int y = 0; y < tile_texels; y++)
+                    for (int x = 0; x < tile_texels; x++) {
+                        // texels past the image edge repeat the last row and column
+                        const int ix = std::min(tx * tile_texels + x, width - 1);
+                        const int iy = std::min(ty * tile_texels + y, height - 1);
+                        for (int c = 0; c < 3; c++) {
+                            const float lin = rgb[(static_cast<size_t>(iy) * width + ix) * 3 + c];
+                            tile[(y * tile_texels + x) * 3 + c] = static_cast<uint8_t>(255.0f * std::sqrt(fmin(lin, 1.0f)) + 0.5f);
+                        }
+                    }
+                    std::fwrite(tile.data(), 1, tile.size(), tiles.file);
+                }
+                tile_count += l.tiles_x * l.tiles_y;
+                levels.push_back(l);
+
+                if (width == 1 && height == 1) break;
+
+                const int w = std::max(width / 2, 1);
+                const int h = std::max(height / 2, 1);
+                std::vector<float> next(static_cast<size_t>(w) * h * 3);
+                for (int y = 0; y < h; y++)
+                for (int x = 0; x < w; x++)
+                for (int c = 0; c < 3; c++) {
+                    const int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+                    const int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+                    next[(static_cast<size_t>(y) * w + x) * 3 + c] = 0.25f * (
+                        rgb[(static_cast<size_t>(y0) * width + x0) * 3 + c] + rgb[(static_cast<size_t>(y0) * width + x1) * 3 + c] +
+                        rgb[(static_cast<size_t>(y1) * width + x0) * 3 + c] + rgb[(static_cast<size_t>(y1) * width + x1) * 3 + c]);
+                }
+                rgb.swap(next);
+                width = w;
+                height = h;
+            }
+
+            if (std::fflush(tiles.file) != 0) {
+                std::cerr << "Could not write the texture tile file.\n";
+                levels.clear();
+            }
+        }
+
+        color texel(const level& l, int x, int y) const {
+            x = ((x % l.width) + l.width) % l.width;
+            y = ((y % l.height) + l.height) % l.height;
+            const uint32_t index = l.first_tile + (y / tile_texels) * l.tiles_x + (x / tile_texels);
+            auto t = texture_cache::global().get(tiles, index);
+            const uint8_t* px = &(*t)[((y % tile_texels) * tile_texels + (x % tile_texels)) * 3];
+            const double s = 1.0 / 255.0;
+            return color(px[0] * s * px[0] * s, px[1] * s * px[1] * s, px[2] * s * px[2] * s);
+        }
+
+        color bilinear(int lvl, double u, double v) const {
+            const level& l = levels[lvl];
+            const double x = u * l.width - 0.5;
+            const double y = v * l.height - 0.5;
+            const int x0 = static_cast<int>(std::floor(x));
+            const int y0 = static_cast<int>(std::floor(y));
+            const double fx = x - x0, fy = y - y0;
+
+            return (1 - fy) * ((1 - fx) * texel(l, x0, y0) + fx * texel(l, x0 + 1, y0))
+                 + fy * ((1 - fx) * texel(l, x0, y0 + 1) + fx * texel(l, x0 + 1, y0 + 1));
+        }
+
+    private:
+        std::vector<level> levels;
+        tile_source tiles;
+};
+
+#endif
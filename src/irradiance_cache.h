@@ -0,0 +1,204 @@
+#ifndef IRRADIANCE_CACHE_H
+#define IRRADIANCE_CACHE_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+
+#include <atomic>
+#include <cstddef>
+
+// Ward's irradiance cache. Indirect diffuse light changes slowly over a surface, so the
+// irradiance found with a hemisphere of rays at one point is reused at the points around
+// it, as far as the distance to the surrounding geometry allows.
+//
+// Records live in an octree. A record is linked into every node it overlaps at the depth
+// where nodes are about as large as the area it is valid in, so a lookup only reads the
+// nodes on the way down to the query point. Render threads look up and insert at the same
+// time without locks: children and records are published with a compare and swap on the
+// pointer that leads to them, and are never changed or freed until the cache is.
+class irradiance_cache {
+    public:
+        // accuracy is Ward's a, the error allowed before a new record is needed. The
+        // distance to nearby geometry is clamped to [min_radius, max_radius] in world
+        // units, so records don't pile up in corners or stretch over open ground, and a
+        // record reaches at least min_pixels pixels around it, so close geometry doesn't
+        // need a record for every sample.
+        irradiance_cache(const aabb& bounds, double min_radius, double max_radius, double accuracy = 0.25,
+            double min_pixels = 2);
+        ~irradiance_cache();
+
+        irradiance_cache(const irradiance_cache&) = delete;
+        irradiance_cache& operator=(const irradiance_cache&) = delete;
+
+        // The weighted irradiance of the records valid at p with normal n. Returns false when
+        // there are none.
+        bool lookup(const point3& p, const vec3& n, color& irradiance) const;
+
+        // Adds the irradiance found at p, where mean_distance is the harmonic mean distance
+        // of the rays that were traced to find it, and footprint the width of a pixel at p.
+        void insert(const point3& p, const vec3& n, const color& irradiance, double mean_distance,
+            double footprint = 0);
+
+        size_t size() const { return record_count.load(std::memory_order_relaxed); }
+
+    public:
+        static const int max_depth = 24;
+
+    private:
+        struct record {
+            point3 p;
+            vec3 n;
+            color irradiance;
+            double radius;
+            record* next_owned; // every record ever inserted, for the destructor
+        };
+
+        struct entry {
+            const record* rec;
+            entry* next;
+        };
+
+        struct node {
+            std::atomic<node*> child[8];
+            std::atomic<entry*> entries{nullptr};
+
+            node() { for (auto& c : child) c.store(nullptr, std::memory_order_relaxed); }
+            ~node();
+        };
+
+        // Ward's weight of r at p, 0 where r doesn't apply.
+        double weight(const record& r, const point3& p, const vec3& n) const;
+
+        void link(node* nd, const aabb& box, const record* r, double extent, int depth);
+
+        static aabb child_box(const aabb& box, int c) {
+            const point3 mid = 0.5 * (box.min() + box.max());
+            point3 lo, hi;
+            for (int a = 0; a < 3; a++) {
+                const bool upper = (c >> a) & 1;
+                lo[a] = upper ? mid[a] : box.min()[a];
+                hi[a] = upper ? box.max()[a] : mid[a];
+            }
+            return aabb(lo, hi);
+        }
+
+    private:
+        aabb box;
+        double min_r, max_r, a, min_px;
+        node root;
+        std::atomic<record*> records{nullptr};
+        std::atomic<size_t> record_count{0};
+};
+
+irradiance_cache::node::~node() {
+    for (auto& c : child) delete c.load(std::memory_order_relaxed);
+    entry* e = entries.load(std::memory_order_relaxed);
+    while (e) {
+        entry* next = e->next;
+        delete e;
+        e = next;
+    }
+}
+
+irradiance_cache::irradiance_cache(const aabb& bounds, double min_radius, double max_radius, double accuracy,
+    double min_pixels)
+    : box(bounds), min_r(min_radius), max_r(max_radius), a(accuracy), min_px(min_pixels)
+{
+    // a cubic root keeps the children of a node cubic as well
+    const vec3 size = bounds.max() - bounds.min();
+    const double side = fmax(size.x(), fmax(size.y(), size.z()));
+    const point3 centre = 0.5 * (bounds.min() + bounds.max());
+    const vec3 half(side / 2, side / 2, side / 2);
+    box = aabb(centre - half, centre + half);
+}
+
+irradiance_cache::~irradiance_cache() {
+    record* r = records.load(std::memory_order_relaxed);
+    while (r) {
+        record* next = r->next_owned;
+        delete r;
+        r = next;
+    }
+}
+
+double irradiance_cache::weight(const record& r, const point3& p, const vec3& n) const {
+    const vec3 d = p - r.p;
+    // skip records in front of p, they see a different part of the scene
+    if (dot(d, r.n + n) < -0.1 * r.radius) return 0;
+    const double e = d.length() / r.radius + sqrt(fmax(0.0, 1 - dot(n, r.n)));
+    if (e >= a) return 0;
+    return e > 1e-9 ? 1 / e : 1e9;
+}
+
+bool irradiance_cache::lookup(const point3& p, const vec3& n, color& irradiance) const {
+    color sum(0,0,0);
+    double total = 0;
+    const node* nd = &root;
+    aabb b = box;
+    while (nd) {
+        for (const entry* e = nd->entries.load(std::memory_order_acquire); e; e = e->next) {
+            const double w = weight(*e->rec, p, n);
+            if (w <= 0) continue;
+            sum += w * e->rec->irradiance;
+            total += w;
+        }
+
+        const point3 mid = 0.5 * (b.min() + b.max());
+        const int c = (p.x() >= mid.x()) | ((p.y() >= mid.y()) << 1) | ((p.z() >= mid.z()) << 2);
+        nd = nd->child[c].load(std::memory_order_acquire);
+        b = child_box(b, c);
+    }
+
+    if (total <= 0) return false;
+    irradiance = sum / total;
+    return true;
+}
+
+void irradiance_cache::insert(const point3& p, const vec3& n, const color& irradiance, double mean_distance,
+    double footprint)
+{
+    // the record applies within a * radius of p, which has to cover min_px pixels
+    const double radius = fmax(clamp(mean_distance, min_r, max_r), min_px * footprint / a);
+    record* r = new record{p, n, irradiance, radius, nullptr};
+    r->next_owned = records.load(std::memory_order_relaxed);
+    while (!records.compare_exchange_weak(r->next_owned, r, std::memory_order_release, std::memory_order_relaxed)) {}
+    record_count.fetch_add(1, std::memory_order_relaxed);
+
+    link(&root, box, r, a * r->radius, 0);
+}
+
+// Descends into the children the record overlaps while they are at least twice its extent
+// across, then links it into the nodes reached. Records outside the bounds stay at the root.
+void irradiance_cache::link(node* nd, const aabb& b, const record* r, double extent, int depth) {
+    const double child_side = 0.5 * (b.max().x() - b.min().x());
+    int linked = 0;
+    if (child_side >= 2 * extent && depth < max_depth) {
+        for (int c = 0; c < 8; c++) {
+            const aabb cb = child_box(b, c);
+            bool overlaps = true;
+            for (int k = 0; k < 3; k++) {
+                if (r->p[k] + extent < cb.min()[k] || r->p[k] - extent > cb.max()[k]) overlaps = false;
+            }
+            if (!overlaps) continue;
+
+            node* child = nd->child[c].load(std::memory_order_acquire);
+            if (!child) {
+                node* fresh = new node();
+                if (nd->child[c].compare_exchange_strong(child, fresh, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    child = fresh;
+                } else {
+                    delete fresh; // another thread got there first, child now holds its node
+                }
+            }
+            link(child, cb, r, extent, depth + 1);
+            linked++;
+        }
+    }
+    if (linked > 0) return;
+
+    entry* e = new entry{r, nd->entries.load(std::memory_order_relaxed)};
+    while (!nd->entries.compare_exchange_weak(e->next, e, std::memory_order_release, std::memory_order_relaxed)) {}
+}
+
+#endif
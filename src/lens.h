@@ -4,85 +4,251 @@
 #include "rtweekend.h"
 #include "hittable.h"
 
+#include <algorithm>
+
+// A solid lens: the part of a cylinder of the given aperture radius that lies between
+// two spherical caps. The lens axis points along direction. The front cap has its
+// vertex at -thickness/2 on the axis and the back cap at +thickness/2.
+//
+// Radii of curvature follow the usual optics sign convention. A radius is positive
+// when its centre of curvature lies further along the axis than the vertex. 0 means
+// a flat surface. So (R, -R) is biconvex, (-R, R) biconcave, and two radii of the
+// same sign make a meniscus.
+//
+// The local frame and the cap centres are set up once in the constructor. hit()
+// intersects the caps and the rim analytically in lens space.
 class lens : public hittable {
     public:
         lens() {}
-        lens(point3 cen, point3 dir, double r, double t, shared_ptr<material> m) : center(cen), direction(dir), radius(r), thickness(t), mat_ptr(m) {};
+
+        // Symmetric biconvex lens with a sharp edge: aperture radius r and centre thickness t.
+        // t is clamped to 2r, where the lens becomes a ball.
+        lens(point3 cen, point3 dir, double r, double t, shared_ptr<material> m)
+            : lens(cen, dir, r, fmin(t, 2*r), symmetric_radius(r, fmin(t, 2*r)), -symmetric_radius(r, fmin(t, 2*r)), m) {}
+
+        lens(point3 cen, vec3 dir, double aperture_radius, double t, double front_radius, double back_radius, shared_ptr<material> m);
 
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+        virtual bool intervals(const ray& r, double t_min, double t_max, ray_intervals& out) const override;
 
     public:
         point3 center;
-        point3 direction;
+        vec3 direction;
         double radius;
         double thickness;
+        double front_radius;
+        double back_radius;
         shared_ptr<material> mat_ptr;
 
     private:
-        static double get_parabola(double radius, double thickness) {
-            double x1 = -radius; double y1 = thickness / 100;
-            double x2 = 0; double y2 = thickness;
-            double x3 = radius; double y3 = thickness / 100;
+        // Radius of curvature of a cap with the given aperture radius and sag.
+        static double symmetric_radius(double r, double t) {
+            const double sag = t / 2;
+            return sag > 0 ? (r*r + sag*sag) / (2*sag) : 0.0;
+        }
+
+        enum surface_id { FRONT, BACK, RIM };
+
+        struct crossing {
+            double t;
+            surface_id surface;
+        };
+
+        // Every point where the ray crosses the lens boundary, sorted by t. At most two per
+        // surface, six in total. o and d are the ray in lens space.
+        int crossings(const vec3& o, const vec3& d, crossing* out) const;
+
+        bool inside_front(const vec3& p) const;
+        bool inside_back(const vec3& p) const;
+        bool inside_rim(const vec3& p) const { return p.x()*p.x() + p.y()*p.y() <= radius_sq * (1 + 1e-9); }
+
+        // outward normal in lens space
+        vec3 normal_at(const vec3& p, surface_id s) const;
 
-            double denom = (x1-x2) * (x1-x3) * (x2-x3);
-            double A     = (x3 * (y2-y1) + x2 * (y1-y3) + x1 * (y3-y2)) / denom;
-            double B     = (x3*x3 * (y1-y2) + x2*x2 * (y3-y1) + x1*x1 * (y2-y3)) / denom;
-            double C     = (x2 * x3 * (x2-x3) * y1+x3 * x1 * (x3-x1) * y2+x1 * x2 * (x1-x2) * y3) / denom;
+        vec3 to_local(const vec3& v) const { return vec3(dot(v, u), dot(v, v_axis), dot(v, w)); }
+        vec3 to_world(const vec3& v) const { return v.x()*u + v.y()*v_axis + v.z()*w; }
 
-            return A;
+    private:
+        vec3 u, v_axis, w;  // lens frame, w along the axis
+        double radius_sq;
+        double z_front, z_back;    // vertices on the axis
+        double c_front, c_back;    // centres of curvature on the axis
+        double inv_front, inv_back; // 1 / radius of curvature, 0 for flat surfaces
+};
+
+lens::lens(point3 cen, vec3 dir, double aperture_radius, double t, double front, double back, shared_ptr<material> m)
+    : center(cen), direction(dir), radius(aperture_radius), thickness(t), front_radius(front), back_radius(back), mat_ptr(m)
+{
+    w = unit_vector(dir);
+    vec3 a = fabs(w.x()) > 0.9 ? vec3(0,1,0) : vec3(1,0,0);
+    v_axis = unit_vector(cross(w, a));
+    u = cross(v_axis, w);
+
+    // a concave cap can't be wider than its sphere
+    for (double R : {front_radius, -back_radius}) {
+        if (R < 0 && -R <= radius) {
+            std::cerr << "lens: aperture radius " << radius << " clamped to the radius of curvature " << fabs(R) << "\n";
+            radius = fabs(R) * 0.999;
         }
+    }
+
+    radius_sq = radius * radius;
+    z_front = -thickness / 2;
+    z_back = thickness / 2;
+    c_front = z_front + front_radius;
+    c_back = z_back + back_radius;
+    inv_front = front_radius != 0 ? 1 / front_radius : 0;
+    inv_back = back_radius != 0 ? 1 / back_radius : 0;
+}
+
+// The front region lies behind the front cap. For a convex cap that is the inside of
+// its sphere, for a concave one the outside, restricted to beyond the sphere's centre.
+bool lens::inside_front(const vec3& p) const {
+    if (front_radius == 0) return p.z() >= z_front - 1e-9;
+    const double d2 = p.x()*p.x() + p.y()*p.y() + (p.z() - c_front)*(p.z() - c_front);
+    const double r2 = front_radius * front_radius;
+    if (front_radius > 0) return d2 <= r2 * (1 + 1e-9);
+    return d2 >= r2 * (1 - 1e-9) && p.z() >= c_front;
+}
 
-        static point3 get_point_on_parabola(double p, point3 intersection_point) {
-            // point3 parabola: (var1, var2, var3) -> f(x) = var1 * x^2 + var2 * x + var3
-            double ix = intersection_point.x();
-            double iy = intersection_point.y();
-            double iz = intersection_point.z();
-            return point3(p * p * p * ix, p * p * p * iy, p * p * p * iz);
+bool lens::inside_back(const vec3& p) const {
+    if (back_radius == 0) return p.z() <= z_back + 1e-9;
+    const double d2 = p.x()*p.x() + p.y()*p.y() + (p.z() - c_back)*(p.z() - c_back);
+    const double r2 = back_radius * back_radius;
+    if (back_radius < 0) return d2 <= r2 * (1 + 1e-9);
+    return d2 >= r2 * (1 - 1e-9) && p.z() <= c_back;
+}
+
+vec3 lens::normal_at(const vec3& p, surface_id s) const {
+    switch (s) {
+        case FRONT: return front_radius == 0 ? vec3(0,0,-1) : (p - vec3(0,0,c_front)) * inv_front;
+        case BACK: return back_radius == 0 ? vec3(0,0,1) : (vec3(0,0,c_back) - p) * inv_back;
+        default: return vec3(p.x(), p.y(), 0) / radius;
+    }
+}
+
+int lens::crossings(const vec3& o, const vec3& d, crossing* out) const {
+    int n = 0;
+    auto candidate = [&](double t, surface_id s) {
+        const vec3 p = o + t*d;
+        // a concave cap is only the half of its sphere on the lens side of the centre
+        const bool on_boundary =
+            (s == FRONT ? front_radius >= 0 || p.z() >= c_front : inside_front(p))
+            && (s == BACK ? back_radius <= 0 || p.z() <= c_back : inside_back(p))
+            && (s == RIM || inside_rim(p));
+        if (on_boundary) out[n++] = crossing{t, s};
+    };
+
+    // the caps, as planes or spheres centred on the axis
+    auto cap = [&](double radius_of_curvature, double vertex, double centre, surface_id s) {
+        if (radius_of_curvature == 0) {
+            if (d.z() != 0) candidate((vertex - o.z()) / d.z(), s);
+            return;
+        }
+        const vec3 oc = o - vec3(0,0,centre);
+        const double a = d.length_squared();
+        const double half_b = dot(oc, d);
+        const double c = oc.length_squared() - radius_of_curvature * radius_of_curvature;
+        const double discriminant = half_b*half_b - a*c;
+        if (discriminant < 0) return;
+        const double sqrtd = sqrt(discriminant);
+        candidate((-half_b - sqrtd) / a, s);
+        candidate((-half_b + sqrtd) / a, s);
+    };
+    cap(front_radius, z_front, c_front, FRONT);
+    cap(back_radius, z_back, c_back, BACK);
+
+    // the rim cylinder
+    const double a = d.x()*d.x() + d.y()*d.y();
+    if (a > 0) {
+        const double half_b = o.x()*d.x() + o.y()*d.y();
+        const double c = o.x()*o.x() + o.y()*o.y() - radius_sq;
+        const double discriminant = half_b*half_b - a*c;
+        if (discriminant >= 0) {
+            const double sqrtd = sqrt(discriminant);
+            candidate((-half_b - sqrtd) / a, RIM);
+            candidate((-half_b + sqrtd) / a, RIM);
         }
+    }
 
-        static point3 get_normal(point3 hit_point, point3 center, double thickness, double radius) {
-            point3 intersection_point = hit_point - center;
-            // get a parabolic function that describes the curve of the lens
-            double parabola = get_parabola(radius, thickness);
-            // get the heights of the parabola at the point of intersection between ray and lens
-            point3 heights = get_point_on_parabola(parabola, intersection_point);
-            // return that height because it corresponds to the normal vector
-            return heights;
-        };
-};
+    std::sort(out, out + n, [](const crossing& x, const crossing& y) { return x.t < y.t; });
+    return n;
+}
 
 bool lens::bounding_box(double time0, double time1, aabb& output_box) const {
-    output_box = aabb(
-        center - vec3(radius, radius, radius),
-        center + vec3(radius, radius, radius));
+    // extent along the axis: the vertices or, for concave caps, the rim
+    auto cap_z = [&](double R, double centre, double vertex) {
+        if (R == 0) return std::make_pair(vertex, vertex);
+        const double rim = centre - (R > 0 ? 1 : -1) * sqrt(fmax(R*R - radius_sq, 0.0));
+        return std::make_pair(fmin(vertex, rim), fmax(vertex, rim));
+    };
+    const auto f = cap_z(front_radius, c_front, z_front);
+    const auto b = cap_z(back_radius, c_back, z_back);
+    const double z0 = fmin(f.first, b.first);
+    const double z1 = fmax(f.second, b.second);
+
+    // the box around the rim disc at both ends, in world space
+    point3 lo(infinity, infinity, infinity);
+    point3 hi(-infinity, -infinity, -infinity);
+    for (int a = 0; a < 3; a++) {
+        // a disc of the aperture radius reaches radius * sqrt(1 - w[a]^2) off the axis
+        const double spread = radius * sqrt(fmax(1 - w[a]*w[a], 0.0));
+        for (double z : {z0, z1}) {
+            const double c = center[a] + z * w[a];
+            lo[a] = fmin(lo[a], c - spread);
+            hi[a] = fmax(hi[a], c + spread);
+        }
+    }
+    const vec3 pad(0.0001, 0.0001, 0.0001);
+    output_box = aabb(lo - pad, hi + pad);
     return true;
 }
 
 bool lens::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    vec3 oc = r.origin() - center;
-    auto a = r.direction().length_squared();
-    auto half_b = dot(oc, r.direction());
-    auto c = oc.length_squared() - radius*radius;
-
-    auto discriminant = half_b*half_b - a*c;
-    if (discriminant < 0) { return false; }
-    auto sqrtd = sqrt(discriminant);
-
-    auto root = (-half_b - sqrtd) / a;
-    if (root < t_min || t_max < root) {
-        root = (-half_b + sqrtd) / a;
-        if (root < t_min || t_max < root) { return false; }
+    STAT_PRIMITIVE(PRIM_LENS);
+    if (thickness <= 0) return false;
+
+    const vec3 o = to_local(r.origin() - center);
+    const vec3 d = to_local(r.direction());
+
+    crossing found[6];
+    const int n = crossings(o, d, found);
+    for (int i = 0; i < n; i++) {
+        if (found[i].t < t_min || found[i].t > t_max) continue;
+
+        const vec3 p = o + found[i].t * d;
+        rec.t = found[i].t;
+        rec.p = r.at(rec.t);
+        rec.set_face_normal(r, unit_vector(to_world(normal_at(p, found[i].surface))));
+        rec.u = 0;
+        rec.v = 0;
+        rec.uv_scale = 0;
+        rec.mat_ptr = mat_ptr;
+        return true;
     }
+    return false;
+}
 
-    rec.t = root;
-    rec.p = r.at(rec.t);
-    vec3 normal = get_normal(rec.p, center, thickness, radius);
-    rec.normal = normal;
-    rec.set_face_normal(r, normal);
-    rec.mat_ptr = mat_ptr;
-
+bool lens::intervals(const ray& r, double t_min, double t_max, ray_intervals& out) const {
+    STAT_PRIMITIVE(PRIM_LENS);
+    if (thickness <= 0) return true;
+
+    const vec3 o = to_local(r.origin() - center);
+    const vec3 d = to_local(r.direction());
+
+    crossing found[6];
+    const int n = crossings(o, d, found);
+    double entry = -infinity;
+    for (int i = 0; i < n; i++) {
+        const bool entering = dot(d, normal_at(o + found[i].t * d, found[i].surface)) < 0;
+        if (entering) {
+            entry = found[i].t;
+        } else if (!out.add(fmax(entry, t_min), fmin(found[i].t, t_max))) {
+            return false;
+        }
+    }
     return true;
 }
 
-#endif
\ No newline at end of file
+#endif
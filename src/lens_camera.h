@@ -0,0 +1,325 @@
+#ifndef LENS_CAMERA_H
+#define LENS_CAMERA_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// One surface of a lens prescription, in millimetres. Surfaces are listed from the
+// scene side towards the film.
+struct lens_element {
+    double radius;          // radius of curvature, positive when the centre lies towards the film, 0 for the aperture stop
+    double thickness;       // distance to the next surface, or to the film for the last one
+    double ior;             // index of the medium behind the surface, 0 or 1 for air
+    double aperture_radius;
+};
+
+// Reads a prescription with one surface per line: radius, thickness, ior and aperture
+// diameter, all in mm. Text after # is a comment.
+bool load_lens_prescription(const std::string& path, std::vector<lens_element>& out) {
+    std::FILE* f = std::fopen(path.c_str(), "r");
+    if (!f) {
+        std::cerr << "Could not open lens file " << path << "\n";
+        return false;
+    }
+
+    out.clear();
+    char line[512];
+    int number = 0;
+    bool ok = true;
+    while (std::fgets(line, sizeof(line), f)) {
+        number++;
+        for (char* c = line; *c; c++) {
+            if (*c == '#') { *c = '\0'; break; }
+        }
+        double radius, thickness, ior, diameter;
+        const int fields = std::sscanf(line, "%lf %lf %lf %lf", &radius, &thickness, &ior, &diameter);
+        if (fields <= 0) continue;  // blank or comment
+        if (fields != 4 || diameter <= 0 || thickness < 0) {
+            std::cerr << path << ":" << number << ": expected radius, thickness, ior and aperture diameter\n";
+            ok = false;
+            break;
+        }
+        out.push_back(lens_element{radius, thickness, ior == 0 ? 1.0 : ior, diameter / 2});
+    }
+    std::fclose(f);
+
+    if (ok && out.empty()) {
+        std::cerr << path << " has no lens surfaces\n";
+        ok = false;
+    }
+    return ok;
+}
+
+// A camera that traces rays from the film through a system of spherical lens surfaces.
+//
+// In camera space the film is the plane z = 0 and the lenses lie towards +z, with the
+// last surface of the prescription closest to the film. Film rays are aimed at the rear
+// surface within the bounds of the exit pupil, precomputed for pupil_bins rings of the
+// film, so nearly all of them make it through the system. Rays that are still blocked
+// are retried a few times.
+class lens_camera : public camera {
+    public:
+        // focus_dist is in world units from the front surface. scale converts millimetres
+        // to world units, the default takes world units as metres. The shutter is open
+        // from time0 to time1.
+        lens_camera(
+            point3 lookfrom,
+            point3 lookat,
+            vec3   vup,
+            const std::vector<lens_element>& prescription,
+            double aspect_ratio,
+            double focus_dist,
+            double film_diagonal = 35.0, // mm
+            double scale = 0.001,
+            double time0 = 0,
+            double time1 = 0
+        );
+
+        virtual ray get_ray(double s, double t) const override;
+
+        // rays leave from all over the front lens
+        virtual bool ray_pyramid(double s0, double s1, double t0, double t1, point3& apex, vec3 corner[4]) const override {
+            return false;
+        }
+
+        virtual double pixel_spread(int image_height) const override {
+            return film_height / (focal_length * image_height);
+        }
+
+        double effective_focal_length() const { return focal_length; }
+
+    public:
+        static const int pupil_bins = 64;
+
+    private:
+        struct pupil_bound {
+            double x0 = infinity, x1 = -infinity, y0 = infinity, y1 = -infinity;
+            bool empty() const { return x0 > x1; }
+        };
+
+        // Traces a camera space ray from the film out of the front surface. Returns false
+        // when a surface or stop blocks it, or it is totally internally reflected.
+        bool trace_from_film(vec3 o, vec3 d, vec3& out_o, vec3& out_d) const;
+
+        // Object space axis crossing of a near axis ray leaving the film centre, as one over
+        // its distance from the front surface. Negative when the film is in front of the
+        // image of infinity.
+        double inverse_conjugate() const;
+
+        void focus(double distance);
+        void compute_focal_length();
+        void compute_exit_pupils();
+
+        int bin(double film_radius) const {
+            const int b = static_cast<int>(film_radius / film_radius_max * pupil_bins);
+            return b < 0 ? 0 : (b >= pupil_bins ? pupil_bins - 1 : b);
+        }
+
+        double rear_z() const { return elements.back().thickness; }
+
+    private:
+        std::vector<lens_element> elements;
+        std::vector<double> vertex_z; // vertex of each surface, measured from the film
+        std::vector<pupil_bound> pupils;
+
+        point3 origin;
+        vec3 right, up, forward;
+        double mm_to_world;
+        double film_width, film_height, film_radius_max;
+        double focal_length;
+};
+
+lens_camera::lens_camera(point3 lookfrom, point3 lookat, vec3 vup, const std::vector<lens_element>& prescription,
+    double aspect_ratio, double focus_dist, double film_diagonal, double scale, double time0, double time1)
+    : elements(prescription), origin(lookfrom), mm_to_world(scale)
+{
+    shutter_open = time0;
+    shutter_close = time1;
+
+    forward = unit_vector(lookat - lookfrom);
+    right = unit_vector(cross(forward, vup));
+    up = cross(right, forward);
+
+    film_height = film_diagonal / sqrt(1 + aspect_ratio * aspect_ratio);
+    film_width = film_height * aspect_ratio;
+    film_radius_max = film_diagonal / 2;
+
+    if (elements.empty()) {
+        std::cerr << "lens_camera: empty prescription\n";
+        elements.push_back(lens_element{0, 50, 1, 10});
+    }
+
+    focus(focus_dist / mm_to_world);
+    compute_focal_length();
+    compute_exit_pupils();
+}
+
+bool lens_camera::trace_from_film(vec3 o, vec3 d, vec3& out_o, vec3& out_d) const {
+    for (int i = static_cast<int>(elements.size()) - 1; i >= 0; i--) {
+        const lens_element& e = elements[i];
+        const double z = vertex_z[i];
+
+        double t;
+        vec3 normal;
+        if (e.radius == 0) {
+            if (d.z() <= 0) return false;
+            t = (z - o.z()) / d.z();
+        } else {
+            const vec3 centre(0, 0, z - e.radius);
+            const vec3 oc = o - centre;
+            const double a = d.length_squared();
+            const double half_b = dot(oc, d);
+            const double c = oc.length_squared() - e.radius * e.radius;
+            const double discriminant = half_b*half_b - a*c;
+            if (discriminant < 0) return false;
+            const double sqrtd = sqrt(discriminant);
+            // a surface curving away from the film is met on the near side of its sphere
+            t = e.radius < 0 ? (-half_b - sqrtd) / a : (-half_b + sqrtd) / a;
+            normal = unit_vector(o + t*d - centre);
+        }
+        if (t <= 0) return false;
+
+        o = o + t*d;
+        if (o.x()*o.x() + o.y()*o.y() > e.aperture_radius * e.aperture_radius) return false;
+
+        if (e.radius != 0) {
+            // from the medium behind this surface into the one in front of it
+            const double eta = e.ior / (i > 0 ? elements[i-1].ior : 1.0);
+            const vec3 unit_d = unit_vector(d);
+            if (dot(normal, unit_d) > 0) normal = -normal;
+            const double cos_theta = fmin(-dot(unit_d, normal), 1.0);
+            if (eta * eta * (1 - cos_theta*cos_theta) > 1) return false;
+            d = refract(unit_d, normal, eta);
+        }
+    }
+    out_o = o;
+    out_d = d;
+    return true;
+}
+
+double lens_camera::inverse_conjugate() const {
+    vec3 o, d;
+    if (!trace_from_film(vec3(0,0,0), vec3(1e-3, 0, 1), o, d)) return 0.0;
+    // x(t) = o.x + t d.x reaches the axis at z = o.z - o.x d.z / d.x
+    return d.x() / ((o.z() - vertex_z[0]) * d.x() - o.x() * d.z());
+}
+
+// Moves the film, by changing the last thickness, until a point on the axis at the given
+// distance in front of the lens is in focus. Bisection on the paraxial conjugate, which only
+// grows as the film moves back.
+void lens_camera::focus(double distance) {
+    auto place = [&](double film_distance) {
+        elements.back().thickness = film_distance;
+        vertex_z.assign(elements.size(), 0.0);
+        double z = 0;
+        for (int i = static_cast<int>(elements.size()) - 1; i >= 0; i--) {
+            z += elements[i].thickness;
+            vertex_z[i] = z;
+        }
+    };
+
+    const double file_distance = elements.back().thickness;
+    const double target = 1 / distance;
+    double lo = 1e-3, hi = 1e3;
+    place(lo);
+    const double g_lo = inverse_conjugate();
+    place(hi);
+    const double g_hi = inverse_conjugate();
+    if (!(g_lo < target && target < g_hi)) {
+        std::cerr << "lens_camera: can't focus at " << distance << " mm, keeping the film at " << file_distance << " mm\n";
+        place(file_distance);
+        return;
+    }
+
+    for (int i = 0; i < 100; i++) {
+        const double mid = 0.5 * (lo + hi);
+        place(mid);
+        if (inverse_conjugate() < target) lo = mid;
+        else hi = mid;
+    }
+    place(0.5 * (lo + hi));
+}
+
+// A ray leaving the film parallel to the axis at height h crosses the axis in object
+// space with slope -h / f.
+void lens_camera::compute_focal_length() {
+    const double h = 1e-3 * elements.back().aperture_radius;
+    vec3 o, d;
+    if (trace_from_film(vec3(h, 0, 0), vec3(0, 0, 1), o, d) && d.x() < 0) {
+        focal_length = -h * d.z() / d.x();
+    } else {
+        std::cerr << "lens_camera: the lens system doesn't converge, assuming a 50 mm focal length\n";
+        focal_length = 50.0;
+    }
+}
+
+// For every ring of the film, traces a grid of rays from points along +x to the square
+// around the rear surface and keeps the bounds of those that get through, grown by one
+// grid cell to cover what the grid missed.
+void lens_camera::compute_exit_pupils() {
+    const int grid = 64;
+    const int film_points = 4;
+    const double extent = 1.5 * elements.back().aperture_radius;
+    const double cell = 2 * extent / grid;
+
+    pupils.assign(pupil_bins, pupil_bound());
+    for (int b = 0; b < pupil_bins; b++) {
+        pupil_bound& bound = pupils[b];
+        for (int f = 0; f < film_points; f++) {
+            const double x = film_radius_max * (b + f / (film_points - 1.0)) / pupil_bins;
+            const vec3 film(x, 0, 0);
+            for (int j = 0; j < grid; j++)
+            for (int i = 0; i < grid; i++) {
+                const vec3 target(-extent + (i + 0.5) * cell, -extent + (j + 0.5) * cell, rear_z());
+                vec3 o, d;
+                if (!trace_from_film(film, target - film, o, d)) continue;
+                bound.x0 = fmin(bound.x0, target.x());
+                bound.x1 = fmax(bound.x1, target.x());
+                bound.y0 = fmin(bound.y0, target.y());
+                bound.y1 = fmax(bound.y1, target.y());
+            }
+        }
+        if (!bound.empty()) {
+            bound.x0 = fmax(bound.x0 - cell, -extent);
+            bound.x1 = fmin(bound.x1 + cell, extent);
+            bound.y0 = fmax(bound.y0 - cell, -extent);
+            bound.y1 = fmin(bound.y1 + cell, extent);
+        }
+    }
+}
+
+ray lens_camera::get_ray(double s, double t) const {
+    // the image is upside down on the film
+    const vec3 film((0.5 - s) * film_width, (0.5 - t) * film_height, 0);
+    const double r = sqrt(film.x()*film.x() + film.y()*film.y());
+    const pupil_bound& b = pupils[bin(r)];
+
+    if (!b.empty()) {
+        // the bounds are for film points on +x, turn them to this one
+        const double cos_phi = r > 0 ? film.x() / r : 1.0;
+        const double sin_phi = r > 0 ? film.y() / r : 0.0;
+        for (int attempt = 0; attempt < 16; attempt++) {
+            const double px = random_double(b.x0, b.x1);
+            const double py = random_double(b.y0, b.y1);
+            const vec3 target(cos_phi * px - sin_phi * py, sin_phi * px + cos_phi * py, rear_z());
+
+            vec3 o, d;
+            if (!trace_from_film(film, target - film, o, d)) continue;
+            return ray(
+                origin + mm_to_world * (o.x()*right + o.y()*up + o.z()*forward),
+                d.x()*right + d.y()*up + d.z()*forward,
+                shutter_time()
+            );
+        }
+    }
+    // vignetted: a ray without a direction carries no light
+    return ray(origin, vec3(0,0,0));
+}
+
+#endif
@@ -13,9 +13,24 @@ int main() {
     const int samples_per_pixel = 50;
     const int max_depth = 10;
     color background(1,1,1);
+    // interpolate indirect diffuse light from an irradiance cache instead of path tracing
+    // it. Faster, but slightly biased: records are blended over their validity radius.
+    const bool use_cache = false;
+
+    // frames are encoded in the background while the next one renders
+    frame_writer writer(FORMAT_PPM);
 
     int o = 0;
     for(double j = 0.5; j < 2; j += 0.3) {
+        // built once per thickness and shared read-only with the renderer
+        auto world = scene_builder(di_test(j)).commit();
+
+        // indirect diffuse lighting doesn't depend on the camera, so every frame of the
+        // sweep adds to and reuses the same irradiance cache
+        aabb bounds;
+        world->root().bounding_box(0, 0, bounds);
+        irradiance_cache cache(bounds, 0.02, 10.0);
+
         for(double i = -2; i < 2; i += 0.5) {
             point3 lookfrom = point3(i, 1, -2);
             point3 lookat = point3(0, 1, -7);
@@ -26,23 +41,27 @@ int main() {
 
             auto cam = camera(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus);
 
-            auto world = di_test(j);
-
-            render_image(
+            render_to_writer(
+                &writer,
                 cam,
                 std::to_string(o),
                 image_width,
                 image_height,
                 samples_per_pixel,
-                world,
+                *world,
                 max_depth,
                 background,
-                1
+                o,
+                use_cache ? &cache : nullptr
             );
 
             o++;
         }
     }
 
+    writer.finish();
+
+    if (stats_enabled) print_stats(std::cerr, stats_total());
+
     return 0;
 }
\ No newline at end of file
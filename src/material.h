@@ -12,6 +12,30 @@ class material {
             return color(0,0,0);
         }
         virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
+
+        // Surface color without lighting, used for the albedo AOV.
+        virtual color albedo_value(const hit_record& rec) const {
+            return color(0,0,0);
+        }
+
+        // Whether scatter depends on r_in.wavelength, so a spectral path has to follow
+        // a single wavelength from here on.
+        virtual bool dispersive() const {
+            return false;
+        }
+
+        // Density over solid angle with which scatter picks the direction of scattered.
+        // Only for materials that pick directions in proportion to brdf * cos, so that
+        // attenuation is the same for every direction. 0 for the others.
+        virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
+            return 0;
+        }
+
+        // Whether scatter follows a (near) mirror or refraction direction. Photon maps
+        // store photons only on the other, diffuse, materials.
+        virtual bool is_specular() const {
+            return false;
+        }
 };
 
 class lambertian : public material {
@@ -20,16 +44,26 @@ class lambertian : public material {
         lambertian(shared_ptr<texture> a) : albedo(a) {}
 
         virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+            STAT_SCATTER(MAT_LAMBERTIAN);
             auto scatter_direction = rec.normal + random_unit_vector();
 
             // Catch degenerate scatter direction
             if (scatter_direction.near_zero()) { scatter_direction = rec.normal; }
 
-            scattered = ray(rec.p, scatter_direction);
-            attenuation = albedo->value(rec.u, rec.v, rec.p);
+            scattered = ray(rec.p, scatter_direction, r_in.time());
+            attenuation = albedo->value(rec.u, rec.v, rec.p, rec.uv_footprint);
             return true;
         }
 
+        virtual color albedo_value(const hit_record& rec) const override {
+            return albedo->value(rec.u, rec.v, rec.p, rec.uv_footprint);
+        }
+
+        virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const override {
+            const double cosine = dot(rec.normal, unit_vector(scattered.direction()));
+            return cosine < 0 ? 0 : cosine / pi;
+        }
+
     public:
         shared_ptr<texture> albedo;
 };
@@ -41,26 +75,72 @@ class metal : public material {
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const override {
+            STAT_SCATTER(MAT_METAL);
             vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-            scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere());
+            scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere(), r_in.time());
             attenuation = albedo;
             return (dot(scattered.direction(), rec.normal) > 0);
         }
 
+        virtual color albedo_value(const hit_record& rec) const override {
+            return albedo;
+        }
+
+        virtual bool is_specular() const override {
+            return true;
+        }
+
     public:
         color albedo;
         double fuzz;
 };
 
+// Glass. The index of refraction is either constant or follows Cauchy's or Sellmeier's
+// equation, with wavelengths in micrometres. ir is always the index at the helium d line
+// (587.6 nm), which rgb renders use.
 class dielectric : public material {
     public:
         dielectric(double index_of_refraction) : ir(index_of_refraction) {}
 
+        // n = a + b / lambda^2
+        dielectric(double a, double b) : model(CAUCHY), coefficients{a, b} {
+            ir = index_at(d_line);
+        }
+
+        // n^2 = 1 + sum of b_i lambda^2 / (lambda^2 - c_i)
+        dielectric(double b1, double b2, double b3, double c1, double c2, double c3)
+            : model(SELLMEIER), coefficients{b1, b2, b3, c1, c2, c3}
+        {
+            ir = index_at(d_line);
+        }
+
+        // Index of refraction at a wavelength in nm.
+        double index_at(double lambda) const {
+            const double l2 = (lambda * 1e-3) * (lambda * 1e-3);
+            switch (model) {
+                case CAUCHY: return coefficients[0] + coefficients[1] / l2;
+                case SELLMEIER: return sqrt(1 + coefficients[0] * l2 / (l2 - coefficients[3])
+                                              + coefficients[1] * l2 / (l2 - coefficients[4])
+                                              + coefficients[2] * l2 / (l2 - coefficients[5]));
+                default: return ir;
+            }
+        }
+
+        virtual bool dispersive() const override {
+            return model != CONSTANT;
+        }
+
+        virtual bool is_specular() const override {
+            return true;
+        }
+
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const override {
+            STAT_SCATTER(MAT_DIELECTRIC);
             attenuation = color(1.0, 1.0, 1.0);
-            double refraction_ratio = rec.front_face ? (1.0/ir) : ir;
+            const double n = r_in.wavelength > 0 ? index_at(r_in.wavelength) : ir;
+            double refraction_ratio = rec.front_face ? (1.0/n) : n;
 
             vec3 unit_direction = unit_vector(r_in.direction());
             double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
@@ -74,14 +154,24 @@ class dielectric : public material {
             else
                 direction = refract(unit_direction, rec.normal, refraction_ratio);
 
-            scattered = ray(rec.p, direction);
+            scattered = ray(rec.p, direction, r_in.time());
             return true;
         }
 
+        virtual color albedo_value(const hit_record& rec) const override {
+            return color(1.0, 1.0, 1.0);
+        }
+
     public:
         double ir; // Index of Refraction
 
     private:
+        enum dispersion_model { CONSTANT, CAUCHY, SELLMEIER };
+        static constexpr double d_line = 587.6;
+
+        dispersion_model model = CONSTANT;
+        double coefficients[6] = {};
+
         static double reflectance(double cosine, double ref_idx) {
             // Use Schlick's approximation for reflectance.
             auto r0 = (1-ref_idx) / (1+ref_idx);
@@ -98,6 +188,7 @@ class diffuse_light : public material  {
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const override {
+            STAT_SCATTER(MAT_DIFFUSE_LIGHT);
             return false;
         }
 
@@ -105,6 +196,10 @@ class diffuse_light : public material  {
             return emit->value(u, v, p);
         }
 
+        virtual color albedo_value(const hit_record& rec) const override {
+            return emit->value(rec.u, rec.v, rec.p);
+        }
+
     public:
         shared_ptr<texture> emit;
 };
@@ -117,11 +212,16 @@ class isotropic : public material {
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const override {
-            scattered = ray(rec.p, random_in_unit_sphere());
-            attenuation = albedo->value(rec.u, rec.v, rec.p);
+            STAT_SCATTER(MAT_ISOTROPIC);
+            scattered = ray(rec.p, random_in_unit_sphere(), r_in.time());
+            attenuation = albedo->value(rec.u, rec.v, rec.p, rec.uv_footprint);
             return true;
         }
 
+        virtual color albedo_value(const hit_record& rec) const override {
+            return albedo->value(rec.u, rec.v, rec.p, rec.uv_footprint);
+        }
+
     public:
         shared_ptr<texture> albedo;
 };
@@ -0,0 +1,216 @@
+#ifndef MOVING_H
+#define MOVING_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+
+#include <algorithm>
+#include <vector>
+
+// Where an instance is at one moment: moved by offset after turning angle degrees about
+// the y axis, like translate(rotate_y(object, angle), offset).
+struct motion_key {
+    double time;
+    vec3 offset;
+    double angle = 0;
+};
+
+// An instance of an object that moves while the shutter is open. Its placement is
+// interpolated linearly between keys, which are sorted by time, and held before the
+// first and after the last. Rays are moved into object space at their own time, so the
+// object itself stays static.
+class moving : public hittable {
+    public:
+        moving(shared_ptr<hittable> p, std::vector<motion_key> keyframes);
+
+        // Straight line motion from offset0 at time0 to offset1 at time1.
+        moving(shared_ptr<hittable> p, const vec3& offset0, const vec3& offset1, double time0 = 0, double time1 = 1)
+            : moving(p, {motion_key{time0, offset0, 0}, motion_key{time1, offset1, 0}}) {}
+
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+
+        virtual bool motion_bounds(double time0, double time1, aabb& box0, aabb& box1) const override;
+
+        virtual bool intervals(const ray& r, double t_min, double t_max, ray_intervals& out) const override {
+            return ptr->intervals(to_object(r), t_min, t_max, out);
+        }
+
+    public:
+        shared_ptr<hittable> ptr;
+        std::vector<motion_key> keys;
+
+    private:
+        struct placement {
+            vec3 offset;
+            double cos_theta, sin_theta;
+        };
+
+        void interpolate(double time, vec3& offset, double& angle) const;
+
+        placement at(double time) const {
+            vec3 offset;
+            double angle;
+            interpolate(time, offset, angle);
+            const double radians = degrees_to_radians(angle);
+            return placement{offset, std::cos(radians), std::sin(radians)};
+        }
+
+        // The ray in object space. The transform is rigid, so t is the same in both.
+        ray to_object(const ray& r) const {
+            const placement pl = at(r.time());
+            const vec3 o = r.origin() - pl.offset;
+            const vec3 d = r.direction();
+            ray moved(
+                point3(pl.cos_theta*o.x() - pl.sin_theta*o.z(), o.y(), pl.sin_theta*o.x() + pl.cos_theta*o.z()),
+                vec3(pl.cos_theta*d.x() - pl.sin_theta*d.z(), d.y(), pl.sin_theta*d.x() + pl.cos_theta*d.z()),
+                r.time());
+            moved.width = r.width;
+            moved.spread = r.spread;
+            moved.wavelength = r.wavelength;
+            return moved;
+        }
+
+        static vec3 turn(const placement& pl, const vec3& v) {
+            return vec3(pl.cos_theta*v.x() + pl.sin_theta*v.z(), v.y(), -pl.sin_theta*v.x() + pl.cos_theta*v.z());
+        }
+
+        // The object's box placed at time, grown by pad on every side.
+        aabb box_at(double time, double pad) const;
+
+        // Times in [time0, time1] at which box_at is sampled: the ends, every key and
+        // enough steps in between that no segment turns more than max_step degrees.
+        std::vector<double> sample_times(double time0, double time1) const;
+
+        // How far a corner of the rotated box can stray from the chord between two
+        // samples, which box_at adds as padding.
+        double turn_pad() const;
+
+    private:
+        bool hasbox;
+        aabb object_box;
+        double corner_radius = 0; // furthest corner of object_box from the y axis
+
+        static constexpr double max_step = 2.0;
+};
+
+moving::moving(shared_ptr<hittable> p, std::vector<motion_key> keyframes) : ptr(p), keys(keyframes) {
+    if (keys.empty()) keys.push_back(motion_key{0, vec3(0,0,0), 0});
+    std::stable_sort(keys.begin(), keys.end(), [](const motion_key& a, const motion_key& b) { return a.time < b.time; });
+
+    hasbox = ptr->bounding_box(0, 1, object_box);
+    if (hasbox) {
+        for (double x : {object_box.min().x(), object_box.max().x()})
+        for (double z : {object_box.min().z(), object_box.max().z()})
+            corner_radius = fmax(corner_radius, sqrt(x*x + z*z));
+    }
+}
+
+void moving::interpolate(double time, vec3& offset, double& angle) const {
+    size_t i = 0;
+    while (i + 1 < keys.size() && keys[i + 1].time <= time) i++;
+
+    offset = keys[i].offset;
+    angle = keys[i].angle;
+    if (i + 1 < keys.size() && time > keys[i].time) {
+        const double f = (time - keys[i].time) / (keys[i + 1].time - keys[i].time);
+        offset = (1 - f) * keys[i].offset + f * keys[i + 1].offset;
+        angle = (1 - f) * keys[i].angle + f * keys[i + 1].angle;
+    }
+}
+
+bool moving::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    if (!ptr->hit(to_object(r), t_min, t_max, rec)) return false;
+
+    // the hit keeps its side, the normal only turns with the object
+    const placement pl = at(r.time());
+    rec.p = turn(pl, rec.p) + pl.offset;
+    rec.normal = turn(pl, rec.normal);
+    return true;
+}
+
+aabb moving::box_at(double time, double pad) const {
+    const placement pl = at(time);
+    point3 lo(infinity, infinity, infinity);
+    point3 hi(-infinity, -infinity, -infinity);
+    for (int i = 0; i < 8; i++) {
+        const vec3 corner(
+            (i & 1 ? object_box.max() : object_box.min()).x(),
+            (i & 2 ? object_box.max() : object_box.min()).y(),
+            (i & 4 ? object_box.max() : object_box.min()).z());
+        const vec3 p = turn(pl, corner) + pl.offset;
+        for (int a = 0; a < 3; a++) {
+            lo[a] = fmin(lo[a], p[a]);
+            hi[a] = fmax(hi[a], p[a]);
+        }
+    }
+    const vec3 grow(pad, 0, pad);
+    return aabb(lo - grow, hi + grow);
+}
+
+std::vector<double> moving::sample_times(double time0, double time1) const {
+    auto angle_at = [&](double time) {
+        vec3 offset;
+        double angle;
+        interpolate(time, offset, angle);
+        return angle;
+    };
+
+    std::vector<double> times{time0};
+    double t = time0;
+    auto add_until = [&](double end) {
+        // the angle changes linearly up to the next key
+        const double turned = fabs(angle_at(end) - angle_at(t));
+        const int steps = std::max(1, static_cast<int>(std::ceil(turned / max_step)));
+        for (int s = 1; s <= steps; s++) times.push_back(t + (end - t) * s / steps);
+        t = end;
+    };
+    for (const auto& k : keys) {
+        if (k.time > time0 && k.time < time1) add_until(k.time);
+    }
+    add_until(time1);
+    return times;
+}
+
+double moving::turn_pad() const {
+    bool turns = false;
+    for (const auto& k : keys) turns = turns || k.angle != keys[0].angle;
+    if (!turns) return 0;
+    return corner_radius * (1 - std::cos(degrees_to_radians(max_step) / 2));
+}
+
+bool moving::bounding_box(double time0, double time1, aabb& output_box) const {
+    if (!hasbox) return false;
+    const double pad = turn_pad();
+    output_box = box_at(time0, pad);
+    for (double t : sample_times(time0, time1)) output_box = surrounding_box(output_box, box_at(t, pad));
+    return true;
+}
+
+// Starts from the boxes at both ends and widens both wherever their interpolation misses
+// the box at a sample time. Between samples the motion is close to linear, so that the
+// interpolated box keeps containing the object.
+bool moving::motion_bounds(double time0, double time1, aabb& box0, aabb& box1) const {
+    if (!hasbox) return false;
+    const double pad = turn_pad();
+    box0 = box_at(time0, pad);
+    box1 = box_at(time1, pad);
+    if (time1 <= time0) return true;
+
+    vec3 below(0,0,0), above(0,0,0);
+    for (double t : sample_times(time0, time1)) {
+        const double f = (t - time0) / (time1 - time0);
+        const aabb actual = box_at(t, pad);
+        for (int a = 0; a < 3; a++) {
+            below[a] = fmax(below[a], (1 - f) * box0.min()[a] + f * box1.min()[a] - actual.min()[a]);
+            above[a] = fmax(above[a], actual.max()[a] - ((1 - f) * box0.max()[a] + f * box1.max()[a]));
+        }
+    }
+    box0 = aabb(box0.min() - below, box0.max() + above);
+    box1 = aabb(box1.min() - below, box1.max() + above);
+    return true;
+}
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef PHOTON_MAP_H
+#define PHOTON_MAP_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// Caustic photon mapping. Photons leave the lights, bounce off and through specular
+// materials, and are stored where they first land on a diffuse one. Paths straight
+// from a light to a diffuse surface are left to the path tracer, so the map only holds
+// the light that ray_color can't find on its own.
+//
+// Photons live in one array sorted by the cell of a hashed grid, so a radius query reads
+// a few contiguous runs. The map is built once per pass and only read while rendering,
+// so any number of threads can query it at once.
+
+struct photon {
+    float position[3];
+    float direction[3]; // direction of travel when it landed
+    float power[3];
+};
+
+// The top-level objects of a scene that emit light and can be sampled. Lights inside
+// instances or bvh nodes are not found.
+std::vector<shared_ptr<hittable>> find_emitters(const hittable_list& objects) {
+    std::vector<shared_ptr<hittable>> emitters;
+    for (const auto& object : objects.objects) {
+        hit_record rec;
+        double area;
+        if (!object->sample_surface(rec, area)) continue;
+        const color e = rec.mat_ptr ? rec.mat_ptr->emitted(rec.u, rec.v, rec.p) : color(0,0,0);
+        if (e.x() + e.y() + e.z() > 0) emitters.push_back(object);
+    }
+    return emitters;
+}
+
+// Photon radius for the given pass of progressive photon mapping, shrinking so that the
+// average over all passes converges (Knaus and Zwicker's alpha, 2/3 by default).
+inline double progressive_radius(double initial, int pass, double alpha = 2.0 / 3.0) {
+    double r2 = initial * initial;
+    for (int i = 1; i <= pass; i++) r2 *= (i + alpha) / (i + 1);
+    return sqrt(r2);
+}
+
+class photon_map {
+    public:
+        // Shoots photon_count photons split over threads. Photon i is seeded from seed,
+        // pass and i alone, so the map doesn't depend on the thread count.
+        void build(const hittable& world, const std::vector<shared_ptr<hittable>>& emitters, int photon_count,
+            double radius, uint64_t seed, int pass, unsigned threads, int max_depth = 10);
+
+        // Radiance leaving a lambertian surface of the given albedo at rec, from the
+        // photons within the radius that arrived on the side of rec.normal.
+        color estimate(const hit_record& rec, const color& albedo) const;
+
+        size_t size() const { return photons.size(); }
+        double radius() const { return search_radius; }
+
+    private:
+        void trace_photon(const hittable& world, const std::vector<shared_ptr<hittable>>& emitters,
+            const std::vector<double>& cdf, double total_power, int photon_count, int max_depth, std::vector<photon>& out) const;
+
+        void grid_cell(const point3& p, int64_t cell[3]) const {
+            for (int a = 0; a < 3; a++) cell[a] = static_cast<int64_t>(std::floor(p[a] / cell_size));
+        }
+
+        size_t bucket(int64_t x, int64_t y, int64_t z) const {
+            const uint64_t h = static_cast<uint64_t>(x) * 73856093u ^ static_cast<uint64_t>(y) * 19349663u ^ static_cast<uint64_t>(z) * 83492791u;
+            return static_cast<size_t>(h & (bucket_count - 1));
+        }
+
+    private:
+        std::vector<photon> photons;          // sorted by bucket
+        std::vector<uint32_t> bucket_start;   // bucket_count + 1 offsets into photons
+        size_t bucket_count = 1;
+        double search_radius = 0;
+        double cell_size = 1;
+};
+
+void photon_map::trace_photon(const hittable& world, const std::vector<shared_ptr<hittable>>& emitters,
+    const std::vector<double>& cdf, double total_power, int photon_count, int max_depth, std::vector<photon>& out) const
+{
+    // pick a light by power
+    const double u = random_double() * total_power;
+    const size_t light = std::min(static_cast<size_t>(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()), emitters.size() - 1);
+    const double light_pdf = (cdf[light] - (light > 0 ? cdf[light - 1] : 0.0)) / total_power;
+
+    hit_record origin;
+    double area;
+    emitters[light]->sample_surface(origin, area);
+
+    // either side, cosine distributed
+    vec3 normal = random_double() < 0.5 ? origin.normal : -origin.normal;
+    vec3 direction = normal + random_unit_vector();
+    if (direction.near_zero()) direction = normal;
+
+    // radiance * cos / (pdf of the position, direction and side)
+    color power = origin.mat_ptr->emitted(origin.u, origin.v, origin.p) * (2 * pi * area / (light_pdf * photon_count));
+
+    ray r(origin.p, direction);
+    bool specular = false;
+    for (int depth = 0; depth < max_depth; depth++) {
+        hit_record rec;
+        if (!world.hit(r, 0.001, infinity, rec)) return;
+
+        if (!rec.mat_ptr->is_specular()) {
+            if (specular) {
+                const vec3 d = unit_vector(r.direction());
+                out.push_back(photon{
+                    {static_cast<float>(rec.p.x()), static_cast<float>(rec.p.y()), static_cast<float>(rec.p.z())},
+                    {static_cast<float>(d.x()), static_cast<float>(d.y()), static_cast<float>(d.z())},
+                    {static_cast<float>(power.x()), static_cast<float>(power.y()), static_cast<float>(power.z())}});
+            }
+            return;
+        }
+
+        ray scattered;
+        color attenuation;
+        if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered)) return;
+        power = power * attenuation;
+        specular = true;
+        r = scattered;
+    }
+}
+
+void photon_map::build(const hittable& world, const std::vector<shared_ptr<hittable>>& emitters, int photon_count,
+    double radius, uint64_t seed, int pass, unsigned threads, int max_depth)
+{
+    trace_span span("photons", "render", pass);
+    photons.clear();
+    search_radius = radius;
+    cell_size = 2 * radius;
+
+    // lights are chosen by their power, from the average of a few emission samples
+    std::vector<double> cdf;
+    double total_power = 0;
+    for (const auto& e : emitters) {
+        double sum = 0, area = 0;
+        for (int i = 0; i < 16; i++) {
+            hit_record rec;
+            e->sample_surface(rec, area);
+            const color c = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+            sum += (c.x() + c.y() + c.z()) / 3;
+        }
+        total_power += sum / 16 * area;
+        cdf.push_back(total_power);
+    }
+
+    if (photon_count > 0 && total_power > 0) {
+        // contiguous ranges of photons per thread, joined in order
+        threads = std::max(1u, threads);
+        std::vector<std::vector<photon>> found(threads);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                const int first = static_cast<int>(static_cast<int64_t>(photon_count) * t / threads);
+                const int last = static_cast<int>(static_cast<int64_t>(photon_count) * (t + 1) / threads);
+                for (int i = first; i < last; i++) {
+                    seed_sample(seed, i, pass, -1);
+                    trace_photon(world, emitters, cdf, total_power, photon_count, max_depth, found[t]);
+                }
+            });
+        }
+        for (auto& w : workers) w.join();
+        for (auto& f : found) photons.insert(photons.end(), f.begin(), f.end());
+    }
+
+    // counting sort into buckets
+    bucket_count = 1;
+    while (bucket_count < photons.size()) bucket_count <<= 1;
+    bucket_start.assign(bucket_count + 1, 0);
+
+    std::vector<size_t> buckets(photons.size());
+    for (size_t i = 0; i < photons.size(); i++) {
+        int64_t c[3];
+        grid_cell(point3(photons[i].position[0], photons[i].position[1], photons[i].position[2]), c);
+        buckets[i] = bucket(c[0], c[1], c[2]);
+        bucket_start[buckets[i] + 1]++;
+    }
+    for (size_t b = 0; b < bucket_count; b++) bucket_start[b + 1] += bucket_start[b];
+
+    std::vector<photon> sorted(photons.size());
+    std::vector<uint32_t> next(bucket_start.begin(), bucket_start.end() - 1);
+    for (size_t i = 0; i < photons.size(); i++) sorted[next[buckets[i]]++] = photons[i];
+    photons.swap(sorted);
+}
+
+color photon_map::estimate(const hit_record& rec, const color& albedo) const {
+    if (photons.empty()) return color(0,0,0);
+
+    // with cells twice the radius, the query sphere touches at most 2x2x2 of them
+    int64_t lo[3];
+    grid_cell(rec.p - vec3(search_radius, search_radius, search_radius), lo);
+
+    size_t visited[8];
+    int visited_count = 0;
+    const double r2 = search_radius * search_radius;
+    double sum[3] = {0, 0, 0};
+    for (int c = 0; c < 8; c++) {
+        const size_t b = bucket(lo[0] + (c & 1), lo[1] + ((c >> 1) & 1), lo[2] + (c >> 2));
+        // distinct cells can share a bucket, which must not be counted twice
+        if (std::find(visited, visited + visited_count, b) != visited + visited_count) continue;
+        visited[visited_count++] = b;
+
+        for (uint32_t i = bucket_start[b]; i < bucket_start[b + 1]; i++) {
+            const photon& q = photons[i];
+            const double dx = q.position[0] - rec.p.x();
+            const double dy = q.position[1] - rec.p.y();
+            const double dz = q.position[2] - rec.p.z();
+            if (dx*dx + dy*dy + dz*dz > r2) continue;
+            if (q.direction[0] * rec.normal.x() + q.direction[1] * rec.normal.y() + q.direction[2] * rec.normal.z() >= 0) continue;
+            for (int k = 0; k < 3; k++) sum[k] += q.power[k];
+        }
+    }
+
+    // lambertian brdf times the flux density
+    const double scale = 1 / (pi * pi * r2);
+    return albedo * color(sum[0], sum[1], sum[2]) * scale;
+}
+
+#endif
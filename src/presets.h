@@ -0,0 +1,94 @@
+#ifndef PRESETS_H
+#define PRESETS_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "render.h"
+
+#include <string>
+#include <vector>
+
+// A built-in scene together with the camera and background it is meant to be seen with.
+struct scene_preset {
+    std::string name;
+    hittable_list objects;
+    point3 lookfrom;
+    point3 lookat;
+    vec3 vup = vec3(0,1,0);
+    double vfov = 40.0;
+    double aperture = 0.0;
+    double dist_to_focus = 10.0;
+    double time0 = 0, time1 = 0; // shutter
+    color background;
+
+    camera make_camera(double aspect_ratio) const {
+        return camera(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus, time0, time1);
+    }
+};
+
+inline std::vector<std::string> preset_names() {
+    return {"di_test", "lens_showcase", "random_scene", "motion_scene", "final_scene", "smoke_scene", "texture_scene", "sparse_scene"};
+}
+
+// Builds the named scene. param is the lens thickness for di_test and ignored otherwise.
+// The random scenes draw from the calling thread's generator, so seed it first to get
+// the same scene in every process.
+bool load_preset(const std::string& name, double param, scene_preset& out) {
+    out.name = name;
+    if (name == "di_test") {
+        out.objects = di_test(param);
+        out.lookfrom = point3(-2, 1, -4);
+        out.lookat = point3(0, 1, -7);
+        out.dist_to_focus = (out.lookfrom - out.lookat).length();
+        out.background = color(1,1,1);
+    } else if (name == "lens_showcase") {
+        out.objects = lens_showcase();
+        out.lookfrom = point3(278, 278, -800);
+        out.lookat = point3(278, 278, 0);
+        out.background = color(0,0,0);
+    } else if (name == "random_scene") {
+        out.objects = random_scene();
+        out.lookfrom = point3(13, 2, 3);
+        out.lookat = point3(0, 0, 0);
+        out.vfov = 20.0;
+        out.aperture = 0.1;
+        out.background = color(0.70, 0.80, 1.00);
+    } else if (name == "motion_scene") {
+        out.objects = motion_scene();
+        out.lookfrom = point3(13, 2, 3);
+        out.lookat = point3(0, 0, 0);
+        out.vfov = 20.0;
+        out.time1 = 1.0;
+        out.background = color(0.70, 0.80, 1.00);
+    } else if (name == "final_scene") {
+        out.objects = final_scene();
+        out.lookfrom = point3(478, 278, -600);
+        out.lookat = point3(278, 278, 0);
+        out.background = color(0,0,0);
+    } else if (name == "smoke_scene") {
+        out.objects = smoke_scene();
+        out.lookfrom = point3(0, 3, 12);
+        out.lookat = point3(0, 2, 0);
+        out.vfov = 30.0;
+        out.background = color(0.70, 0.80, 1.00);
+    } else if (name == "texture_scene") {
+        // generated, so the preset runs without any image files
+        out.objects = texture_scene(make_shared<image_texture>(512, 512, texture_test_pattern(512)));
+        out.lookfrom = point3(0, 3, 10);
+        out.lookat = point3(0, 1.5, 0);
+        out.vfov = 40.0;
+        out.background = color(0.70, 0.80, 1.00);
+    } else if (name == "sparse_scene") {
+        out.objects = sparse_scene();
+        out.lookfrom = point3(0, 0, 40);
+        out.lookat = point3(0, 0, 0);
+        out.vfov = 40.0;
+        out.background = color(0.70, 0.80, 1.00);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef QOI_H
+#define QOI_H
+
+#include <cstdint>
+#include <vector>
+
+// Encoder for the "Quite OK Image" format (https://qoiformat.org), a simple
+// lossless format that compresses rendered frames well and encodes much faster
+// than PNG. Only 3 channel sRGB images are written.
+
+inline void qoi_put_u32(std::vector<char>& out, uint32_t v) {
+    out.push_back(static_cast<char>((v >> 24) & 0xff));
+    out.push_back(static_cast<char>((v >> 16) & 0xff));
+    out.push_back(static_cast<char>((v >> 8) & 0xff));
+    out.push_back(static_cast<char>(v & 0xff));
+}
+
+// rgb holds width * height pixels, rows from top to bottom.
+void encode_qoi(const uint8_t* rgb, int width, int height, std::vector<char>& out) {
+    const uint8_t OP_INDEX = 0x00;
+    const uint8_t OP_DIFF = 0x40;
+    const uint8_t OP_LUMA = 0x80;
+    const uint8_t OP_RUN = 0xc0;
+    const uint8_t OP_RGB = 0xfe;
+
+    out.reserve(out.size() + 14 + static_cast<size_t>(width) * height * 4 + 8);
+    out.push_back('q'); out.push_back('o'); out.push_back('i'); out.push_back('f');
+    qoi_put_u32(out, width);
+    qoi_put_u32(out, height);
+    out.push_back(3); // channels
+    out.push_back(0); // sRGB with linear alpha
+
+    uint8_t index[64][3] = {};
+    bool index_used[64] = {};
+    uint8_t pr = 0, pg = 0, pb = 0;
+    int run = 0;
+
+    const size_t pixel_count = static_cast<size_t>(width) * height;
+    for (size_t i = 0; i < pixel_count; i++) {
+        const uint8_t r = rgb[i*3 + 0];
+        const uint8_t g = rgb[i*3 + 1];
+        const uint8_t b = rgb[i*3 + 2];
+
+        if (r == pr && g == pg && b == pb) {
+            run++;
+            if (run == 62 || i == pixel_count - 1) {
+                out.push_back(static_cast<char>(OP_RUN | (run - 1)));
+                run = 0;
+            }
+            continue;
+        }
+
+        if (run > 0) {
+            out.push_back(static_cast<char>(OP_RUN | (run - 1)));
+            run = 0;
+        }
+
+        // alpha is always 255
+        const int hash = (r*3 + g*5 + b*7 + 255*11) % 64;
+        if (index_used[hash] && index[hash][0] == r && index[hash][1] == g && index[hash][2] == b) {
+            out.push_back(static_cast<char>(OP_INDEX | hash));
+        } else {
+            index[hash][0] = r; index[hash][1] = g; index[hash][2] = b;
+            index_used[hash] = true;
+
+            const int8_t dr = static_cast<int8_t>(r - pr);
+            const int8_t dg = static_cast<int8_t>(g - pg);
+            const int8_t db = static_cast<int8_t>(b - pb);
+            const int8_t dr_dg = static_cast<int8_t>(dr - dg);
+            const int8_t db_dg = static_cast<int8_t>(db - dg);
+
+            if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
+                out.push_back(static_cast<char>(OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+            } else if (dg > -33 && dg < 32 && dr_dg > -9 && dr_dg < 8 && db_dg > -9 && db_dg < 8) {
+                out.push_back(static_cast<char>(OP_LUMA | (dg + 32)));
+                out.push_back(static_cast<char>((dr_dg + 8) << 4 | (db_dg + 8)));
+            } else {
+                out.push_back(static_cast<char>(OP_RGB));
+                out.push_back(static_cast<char>(r));
+                out.push_back(static_cast<char>(g));
+                out.push_back(static_cast<char>(b));
+            }
+        }
+
+        pr = r; pg = g; pb = b;
+    }
+
+    // end marker
+    for (int i = 0; i < 7; i++) out.push_back(0);
+    out.push_back(1);
+}
+
+#endif
@@ -6,18 +6,29 @@
 class ray {
     public:
         ray() {}
-        ray(const point3& origin, const vec3& direction) : orig(origin), dir(direction) {}
+        ray(const point3& origin, const vec3& direction, double time = 0.0)
+            : orig(origin), dir(direction), tm(time) {}
 
         point3 origin() const { return orig; }
         vec3 direction() const { return dir; }
+        double time() const { return tm; }
 
         point3 at(double t) const {
             return orig + t*dir;
         }
 
+        // Width of the cone of rays this one stands for, at parameter t.
+        double footprint(double t) const {
+            return width + spread * t * dir.length();
+        }
+
     public:
         point3 orig;
         vec3 dir;
+        double tm;         // when the ray was sent, within the camera's shutter interval
+        double width = 0;  // cone width at the origin
+        double spread = 0; // growth of the width per unit of distance
+        double wavelength = 0; // hero wavelength in nm for spectral renders, 0 for rgb
 };
 
 #endif
\ No newline at end of file
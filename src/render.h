@@ -3,16 +3,28 @@
 
 #include "rtweekend.h"
 
+#include "aov.h"
 #include "camera.h"
 #include "color.h"
 #include "hittable_list.h"
 #include "sphere.h"
 #include "lens.h"
 #include "material.h"
+#include "moving.h"
 #include "aarect.h"
 #include "box.h"
 #include "constant_medium.h"
-#include "render.h"
+#include "environment.h"
+#include "grid_medium.h"
+#include "image_texture.h"
+#include "irradiance_cache.h"
+#include "framebuffer.h"
+#include "frame_writer.h"
+#include "render_pool.h"
+#include "photon_map.h"
+#include "scene.h"
+#include "sd_tree.h"
+#include "spectrum.h"
 #include "bvh.h"
 
 #include <iostream>
@@ -20,26 +32,336 @@
 #include <fstream>
 #include <thread>
 
-color ray_color(const ray& r, const color& background, const hittable& world, int depth) {
+// The first hit along a path fills the aovs, every hit counts towards the path depth.
+void record_aov(aov_sample& aov, const hit_record& rec) {
+    if (!aov.hit) {
+        aov.hit = true;
+        aov.depth = rec.t;
+        aov.normal = rec.normal;
+        aov.albedo = rec.mat_ptr->albedo_value(rec);
+        aov.object_id = rec.object_id;
+    }
+    aov.path_depth++;
+}
+
+// The start of every bounce: ends paths that ran out of depth or were blocked inside the
+// camera, and finds where r hits target, with its texture footprint and aovs. Returns
+// false when there is nothing to shade, with missed telling whether r left the scene.
+bool find_hit(const ray& r, const hittable& target, int depth, aov_sample* aov, hit_record& rec, bool& missed) {
+    missed = false;
+    if (depth <= 0) {
+        STAT_PATH_END(TERM_MAX_DEPTH);
+        return false;
+    }
+
+    // a camera ray that was blocked inside the camera
+    if (r.direction().length_squared() == 0) return false;
+
+    if (!target.hit(r, 0.001, infinity, rec)) {
+        STAT_PATH_END(TERM_MISS);
+        missed = true;
+        return false;
+    }
+
+    rec.uv_footprint = r.footprint(rec.t) * rec.uv_scale;
+    if (aov) record_aov(*aov, rec);
+    return true;
+}
+
+// primary, when given, is intersected instead of world for r itself, and must hold every
+// object r can hit. Camera rays of a tile use it to skip the objects outside the tile.
+color ray_color(const ray& r, const color& background, const hittable& world, int depth, aov_sample* aov = nullptr,
+    const hittable* primary = nullptr)
+{
+    hit_record rec;
+    bool missed;
+    if (!find_hit(r, primary ? *primary : world, depth, aov, rec, missed)) return missed ? background : color(0,0,0);
+
+    ray scattered;
+    color attenuation;
+    color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+
+    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
+        STAT_PATH_END(TERM_ABSORBED);
+        return emitted;
+    }
+
+    STAT_RAY(RAY_SCATTER);
+    // the footprint keeps growing at the camera's rate, which is optimistic for diffuse bounces
+    scattered.width = r.footprint(rec.t);
+    scattered.spread = r.spread;
+    return emitted + attenuation * ray_color(scattered, background, world, depth-1, aov);
+}
+
+// ray_color for the wavelengths in wl, with r.wavelength set to the hero. Materials and
+// lights stay rgb and are converted to spectra at each hit.
+spectrum ray_spectrum(const ray& r, const color& background, const hittable& world, int depth, wavelengths& wl, aov_sample* aov = nullptr) {
+    hit_record rec;
+    bool missed;
+    if (!find_hit(r, world, depth, aov, rec, missed)) return missed ? rgb_to_spectrum(background, wl) : spectrum(0.0);
+
+    ray scattered;
+    color attenuation;
+    const spectrum emitted = rgb_to_spectrum(rec.mat_ptr->emitted(rec.u, rec.v, rec.p), wl);
+
+    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
+        STAT_PATH_END(TERM_ABSORBED);
+        return emitted;
+    }
+    if (rec.mat_ptr->dispersive()) wl.secondary_terminated = true;
+
+    STAT_RAY(RAY_SCATTER);
+    scattered.width = r.footprint(rec.t);
+    scattered.spread = r.spread;
+    scattered.wavelength = r.wavelength;
+    return emitted + rgb_to_spectrum(attenuation, wl) * ray_spectrum(scattered, background, world, depth-1, wl, aov);
+}
+
+// One spectral sample of a camera ray, as rgb.
+color ray_color_spectral(ray r, const color& background, const hittable& world, int depth, aov_sample* aov = nullptr) {
+    wavelengths wl = sample_wavelengths(random_double());
+    r.wavelength = wl.hero();
+    const spectrum s = ray_spectrum(r, background, world, depth, wl, aov);
+    return spectrum_to_rgb(s, wl);
+}
+
+// ray_color with caustics from a photon map. Every diffuse hit adds the light the
+// photons brought there through specular materials. A path that reaches a light along
+// such a route itself (diffuse, one or more specular bounces, light) is not counted, as
+// the photons already cover it. caustic_route tracks that: 0 before the first diffuse
+// hit, 1 right after one and 2 once specular bounces follow it.
+color ray_color_photons(const ray& r, const color& background, const hittable& world, int depth,
+    const photon_map& caustics, aov_sample* aov = nullptr, int caustic_route = 0)
+{
+    hit_record rec;
+    bool missed;
+    if (!find_hit(r, world, depth, aov, rec, missed)) return missed ? background : color(0,0,0);
+
+    ray scattered;
+    color attenuation;
+    const color emitted = caustic_route == 2 ? color(0,0,0) : rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+
+    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
+        STAT_PATH_END(TERM_ABSORBED);
+        return emitted;
+    }
+
+    color caustic(0,0,0);
+    int next_route;
+    if (rec.mat_ptr->is_specular()) {
+        next_route = caustic_route == 0 ? 0 : 2;
+    } else {
+        caustic = caustics.estimate(rec, rec.mat_ptr->albedo_value(rec));
+        next_route = 1;
+    }
+
+    STAT_RAY(RAY_SCATTER);
+    scattered.width = r.footprint(rec.t);
+    scattered.spread = r.spread;
+    return emitted + caustic + attenuation * ray_color_photons(scattered, background, world, depth-1, caustics, aov, next_route);
+}
+
+// ray_color that learns where light comes from while rendering. At materials that report
+// a scattering_pdf, the direction comes from guide with probability guide_fraction and
+// from the material otherwise, weighted by the combined density. The radiance found in
+// that direction is recorded into guide for the next pass.
+color ray_color_guided(const ray& r, const color& background, const hittable& world, int depth,
+    sd_tree& guide, double guide_fraction = 0.5, aov_sample* aov = nullptr)
+{
+    hit_record rec;
+    bool missed;
+    if (!find_hit(r, world, depth, aov, rec, missed)) return missed ? background : color(0,0,0);
+
+    ray scattered;
+    color attenuation;
+    color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+
+    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
+        STAT_PATH_END(TERM_ABSORBED);
+        return emitted;
+    }
+
+    // density of the direction taken, 0 where nothing is learnt or recorded
+    double pdf = rec.mat_ptr->scattering_pdf(r, rec, scattered);
+    if (pdf > 0 && guide.trained(rec.p)) {
+        vec3 direction;
+        double guide_pdf;
+        if (random_double() < guide_fraction && guide.sample(rec.p, direction, guide_pdf)) {
+            scattered = ray(rec.p, direction, r.time());
+        }
+
+        // attenuation is brdf * cos / material pdf, the same for every direction
+        const double material_pdf = rec.mat_ptr->scattering_pdf(r, rec, scattered);
+        if (material_pdf <= 0) return emitted;
+        pdf = guide_fraction * guide.pdf(rec.p, scattered.direction()) + (1 - guide_fraction) * material_pdf;
+        attenuation = attenuation * (material_pdf / pdf);
+    }
+
+    STAT_RAY(RAY_SCATTER);
+    scattered.width = r.footprint(rec.t);
+    scattered.spread = r.spread;
+    const color incoming = ray_color_guided(scattered, background, world, depth-1, guide, guide_fraction, aov);
+    if (pdf > 0) guide.record(rec.p, scattered.direction(), (incoming.x() + incoming.y() + incoming.z()) / (3 * pdf));
+    return emitted + attenuation * incoming;
+}
+
+// ray_color lit by an environment map instead of a constant background. At materials that
+// report a scattering_pdf, the map is also sampled directly with a shadow ray, and the two
+// ways of reaching it are weighted with the power heuristic. bsdf_pdf is the density the
+// material picked r with, 0 for camera rays and specular bounces, which see the map as is.
+color ray_color_env(const ray& r, const environment_map& env, const hittable& world, int depth,
+    aov_sample* aov = nullptr, double bsdf_pdf = 0)
+{
+    auto power_heuristic = [](double a, double b) { return a * a / (a * a + b * b); };
+
+    hit_record rec;
+    bool missed;
+    if (!find_hit(r, world, depth, aov, rec, missed)) {
+        if (!missed) return color(0,0,0);
+        const color background = env.eval(r.direction());
+        return bsdf_pdf > 0 ? background * power_heuristic(bsdf_pdf, env.pdf(r.direction())) : background;
+    }
+
+    ray scattered;
+    color attenuation;
+    color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+
+    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
+        STAT_PATH_END(TERM_ABSORBED);
+        return emitted;
+    }
+
+    double next_pdf = rec.mat_ptr->scattering_pdf(r, rec, scattered);
+    color direct(0,0,0);
+    if (next_pdf > 0) {
+        double light_pdf;
+        const ray shadow(rec.p, env.sample(light_pdf), r.time());
+        const double material_pdf = light_pdf > 0 ? rec.mat_ptr->scattering_pdf(r, rec, shadow) : 0.0;
+        if (material_pdf > 0) {
+            STAT_RAY(RAY_SCATTER);
+            hit_record blocker;
+            if (!world.hit(shadow, 0.001, infinity, blocker)) {
+                // attenuation * material_pdf is the brdf times the cosine
+                direct = attenuation * env.eval(shadow.direction()) * (material_pdf / light_pdf * power_heuristic(light_pdf, material_pdf));
+            }
+        }
+    }
+
+    STAT_RAY(RAY_SCATTER);
+    scattered.width = r.footprint(rec.t);
+    scattered.spread = r.spread;
+    return emitted + direct + attenuation * ray_color_env(scattered, env, world, depth-1, aov, next_pdf);
+}
+
+// The light r brings back without touching a diffuse surface: the background or a light,
+// reached directly or through glass and mirrors. It makes the sharp shadows and caustics
+// an irradiance cache can't interpolate across.
+color specular_radiance(const ray& r, const color& background, const hittable& world, int depth) {
+    hit_record rec;
+    bool missed;
+    if (!find_hit(r, world, depth, nullptr, rec, missed)) return missed ? background : color(0,0,0);
+
+    ray scattered;
+    color attenuation;
+    const color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered) || !rec.mat_ptr->is_specular()) return emitted;
+
+    STAT_RAY(RAY_SCATTER);
+    return emitted + attenuation * specular_radiance(scattered, background, world, depth-1);
+}
+
+// The rest of what ray_color finds along r: light that left a diffuse surface.
+color bounced_radiance(const ray& r, const color& background, const hittable& world, int depth) {
     hit_record rec;
+    bool missed;
+    if (!find_hit(r, world, depth, nullptr, rec, missed)) return color(0,0,0);
+
+    ray scattered;
+    color attenuation;
+    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered)) return color(0,0,0);
 
-    if (depth <= 0) { return color(0,0,0); }
+    STAT_RAY(RAY_SCATTER);
+    if (rec.mat_ptr->is_specular()) return attenuation * bounced_radiance(scattered, background, world, depth-1);
+    return attenuation * ray_color(scattered, background, world, depth-1);
+}
 
-    // If the ray hits nothing, return the background color.
-    if (!world.hit(r, 0.001, infinity, rec))
-        return background;
+// Indirect irradiance arriving at rec, from strata x strata cosine distributed path traced
+// rays over the hemisphere around the normal. Only light that left another diffuse
+// surface counts, specular_radiance covers the rest. mean_distance is set to the
+// harmonic mean of the distances the rays travelled before hitting something, infinity
+// if none did. The rays are all sent at the given time.
+color sample_irradiance(const hit_record& rec, double time, const color& background, const hittable& world, int depth, int strata, double& mean_distance) {
+    const vec3 w = rec.normal;
+    const vec3 a = fabs(w.x()) > 0.9 ? vec3(0,1,0) : vec3(1,0,0);
+    const vec3 v = unit_vector(cross(w, a));
+    const vec3 u = cross(v, w);
+
+    color sum(0,0,0);
+    double inverse_distances = 0;
+    for (int j = 0; j < strata; j++)
+    for (int i = 0; i < strata; i++) {
+        const double r1 = (i + random_double()) / strata;
+        const double r2 = (j + random_double()) / strata;
+        const double phi = 2 * pi * r1;
+        const double sin_theta = sqrt(r2);
+        const vec3 d = sin_theta * std::cos(phi) * u + sin_theta * std::sin(phi) * v + sqrt(1 - r2) * w;
+
+        const ray probe(rec.p, d, time);
+        hit_record h;
+        if (!world.hit(probe, 0.001, infinity, h)) continue;
+        inverse_distances += 1 / h.t;
+        STAT_RAY(RAY_SCATTER);
+        sum += bounced_radiance(probe, background, world, depth);
+    }
+
+    const int n = strata * strata;
+    mean_distance = inverse_distances > 0 ? n / inverse_distances : infinity;
+    // with cosine distributed rays, irradiance is pi times their mean radiance
+    return sum * (pi / n);
+}
+
+// ray_color that takes the indirect light leaving the first diffuse surface of a path from
+// cache, adding a record there when none is close enough. The rest, direct light and
+// caustics, is traced for every path with specular_radiance. Only materials that report
+// a scattering_pdf count as diffuse, and their brdf is taken to be albedo / pi.
+color ray_color_cached(const ray& r, const color& background, const hittable& world, int depth,
+    irradiance_cache& cache, aov_sample* aov = nullptr, int strata = 12)
+{
+    hit_record rec;
+    bool missed;
+    if (!find_hit(r, world, depth, aov, rec, missed)) return missed ? background : color(0,0,0);
 
     ray scattered;
     color attenuation;
     color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
 
-    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
+        STAT_PATH_END(TERM_ABSORBED);
         return emitted;
+    }
+
+    if (rec.mat_ptr->scattering_pdf(r, rec, scattered) > 0) {
+        color irradiance;
+        if (!cache.lookup(rec.p, rec.normal, irradiance)) {
+            double mean_distance;
+            irradiance = sample_irradiance(rec, r.time(), background, world, depth-1, strata, mean_distance);
+            cache.insert(rec.p, rec.normal, irradiance, mean_distance, r.footprint(rec.t));
+        }
+
+        STAT_RAY(RAY_SCATTER);
+        const color direct = specular_radiance(scattered, background, world, depth-1);
+        return emitted + attenuation * (direct + irradiance / pi);
+    }
 
-    return emitted + attenuation * ray_color(scattered, background, world, depth-1);
+    STAT_RAY(RAY_SCATTER);
+    scattered.width = r.footprint(rec.t);
+    scattered.spread = r.spread;
+    return emitted + attenuation * ray_color_cached(scattered, background, world, depth-1, cache, aov, strata);
 }
 
-hittable_list di_test(double thickness) {
+// The lens in front of an F. lit adds a small light above and in front of the lens,
+// which focuses it into a caustic on the ground behind.
+hittable_list di_test(double thickness, bool lit = false) {
     hittable_list world;
 
     // the ground
@@ -51,7 +373,8 @@ hittable_list di_test(double thickness) {
     world.add(make_shared<sphere>(point3(0,1,1005), 1000, back_mat)); */
 
     // the lens
-    auto material1 = make_shared<dielectric>(1.52);
+    // flint-like dispersion (Abbe number 27) around n = 1.52, which rgb renders use
+    auto material1 = make_shared<dielectric>(1.491037, 0.01);
     world.add(make_shared<lens>(point3(0,1,-7), point3(0, 0, 1), 1.0, thickness, material1));
 
 
@@ -66,6 +389,10 @@ hittable_list di_test(double thickness) {
     world.add(make_shared<box>(point3(0.0,1.6,-10), point3(0.5,2.0,-10), obj_mat));
     world.add(make_shared<box>(point3(0.0,0.8,-10), point3(0.5,1.2,-10), obj_mat));
 
+    if (lit) {
+        world.add(make_shared<sphere>(point3(0,3.5,-4), 0.15, make_shared<diffuse_light>(color(100,100,100))));
+    }
+
     return world;
 }
 
@@ -136,6 +463,53 @@ hittable_list random_scene() {
     return world;
 }
 
+// random_scene with the small diffuse spheres bouncing, and a spinning box, for a shutter
+// open from time 0 to 1.
+hittable_list motion_scene() {
+    hittable_list world;
+
+    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+            if ((center - point3(4, 0.2, 0)).length() <= 0.9) continue;
+
+            if (choose_mat < 0.8) {
+                // diffuse, moving straight up
+                auto albedo = color::random() * color::random();
+                auto ball = make_shared<sphere>(point3(0,0,0), 0.2, make_shared<lambertian>(albedo));
+                world.add(make_shared<moving>(ball, center, center + vec3(0, random_double(0, 0.5), 0)));
+            } else {
+                auto albedo = color::random(0.5, 1);
+                world.add(make_shared<sphere>(center, 0.2, make_shared<metal>(albedo, random_double(0, 0.5))));
+            }
+        }
+    }
+
+    // a ball that falls, bounces and rises again while the shutter is open
+    auto ball = make_shared<sphere>(point3(0,0,0), 1.0, make_shared<lambertian>(color(0.4, 0.2, 0.1)));
+    std::vector<motion_key> bounce;
+    for (int i = 0; i <= 8; i++) {
+        const double t = i / 8.0;
+        const double height = 1 + 2 * (2*t - 1) * (2*t - 1);
+        bounce.push_back(motion_key{t, vec3(-4, height, 0)});
+    }
+    world.add(make_shared<moving>(ball, bounce));
+
+    // a box spinning half a turn as it slides
+    auto crate = make_shared<box>(point3(-0.7,-0.7,-0.7), point3(0.7,0.7,0.7), make_shared<metal>(color(0.7, 0.6, 0.5), 0.1));
+    world.add(make_shared<moving>(crate, std::vector<motion_key>{
+        motion_key{0, vec3(3.6, 0.7, 0), 0},
+        motion_key{1, vec3(4.4, 0.7, 0), 180}}));
+
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, make_shared<dielectric>(1.5)));
+
+    return world;
+}
+
 hittable_list final_scene() {
     hittable_list boxes1;
     auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
@@ -174,8 +548,8 @@ hittable_list final_scene() {
     auto boundary = make_shared<sphere>(point3(360,150,145), 70, make_shared<dielectric>(1.5));
     objects.add(boundary);
     objects.add(make_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
-    boundary = make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
-    objects.add(make_shared<constant_medium>(boundary, .0001, color(1,1,1)));
+    // thin fog around everything, as a single voxel so rays only do a slab test
+    objects.add(make_shared<grid_medium>(point3(-5000,-5000,-5000), point3(5000,5000,5000), 1, 1, 1, std::vector<float>{1.0f}, .0001, color(1,1,1)));
 
     hittable_list boxes2;
     auto white = make_shared<lambertian>(color(.73, .73, .73));
@@ -199,6 +573,70 @@ hittable_list final_scene() {
     return objects;
 }
 
+// A procedural cloud over a ground plane, for the grid medium.
+hittable_list smoke_scene() {
+    hittable_list world;
+
+    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+    world.add(make_shared<sphere>(point3(3, 1, 1), 1.0, make_shared<metal>(color(0.7, 0.6, 0.5), 0.0)));
+
+    // a lumpy ball that fades out towards the edges of its box
+    const int res = 64;
+    auto density = procedural_density(res, res, res, [](const point3& p) {
+        const vec3 d = p - point3(0.5, 0.5, 0.5);
+        const double falloff = fmax(0.0, 1.0 - 2.0 * d.length());
+        const double lumps = 0.6 + 0.4 * std::sin(17 * p.x()) * std::sin(13 * p.y()) * std::sin(19 * p.z());
+        return falloff * lumps;
+    });
+    world.add(make_shared<grid_medium>(point3(-2, 0, -2), point3(2, 4, 2), res, res, res, density, 4.0, color(0.9, 0.9, 0.9)));
+
+    return world;
+}
+
+// Small spheres scattered through the sky with lots of empty space between them, the
+// kind of view where most image tiles see only a few objects or none.
+hittable_list sparse_scene() {
+    hittable_list world;
+
+    for (int i = 0; i < 400; i++) {
+        const point3 center(random_double(-20, 20), random_double(-12, 12), random_double(-10, 10));
+        const auto albedo = color::random() * color::random();
+        world.add(make_shared<sphere>(center, 0.3, make_shared<lambertian>(albedo)));
+    }
+
+    return world;
+}
+
+// A size x size test image for texture_scene: a color gradient under an 8x8 checkerboard,
+// crossed by one texel wide lines every 16 texels that only the finest mip levels resolve.
+std::vector<float> texture_test_pattern(int size) {
+    std::vector<float> rgb;
+    rgb.reserve(static_cast<size_t>(size) * size * 3);
+    for (int y = 0; y < size; y++)
+    for (int x = 0; x < size; x++) {
+        const double u = (x + 0.5) / size, v = (y + 0.5) / size;
+        color c(0.2 + 0.8 * u, 0.3, 0.2 + 0.8 * v);
+        if ((x * 8 / size + y * 8 / size) % 2) c *= 0.25;
+        if (x % 16 == 0 || y % 16 == 0) c = color(1, 1, 1);
+        rgb.push_back(static_cast<float>(c.x()));
+        rgb.push_back(static_cast<float>(c.y()));
+        rgb.push_back(static_cast<float>(c.z()));
+    }
+    return rgb;
+}
+
+// An image textured sphere over a textured floor that recedes into the distance,
+// where the texture lookups move down the mip pyramid.
+hittable_list texture_scene(shared_ptr<texture> image) {
+    hittable_list world;
+
+    world.add(make_shared<xz_rect>(-50, 50, -50, 50, 0, make_shared<lambertian>(image)));
+    world.add(make_shared<sphere>(point3(0, 2, 0), 2.0, make_shared<lambertian>(image)));
+
+    return world;
+}
+
 point3 circle_motion(int i) {
     double theta = i;
     theta /= 5;
@@ -206,51 +644,102 @@ point3 circle_motion(int i) {
     return point3(std::cos(theta)*r, 0, std::sin(theta)*r);
 }
 
-void render_image(camera cam, std::string num, int image_width, int image_height, int samples_per_pixel, hittable_list world, int max_depth, color background, int time) {
-    std::ofstream ppm;
-    ppm.open ("output/image" + num + ".ppm");
-    ppm << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+// Sums samples [first_sample, first_sample + samples_per_pixel) of pixel (i, j). Every
+// sample is seeded from its index, so the sum doesn't depend on who renders it, unless
+// an irradiance cache is shared with other pixels.
+color render_pixel(const camera& cam, int i, int j, int image_width, int image_height, int samples_per_pixel, const hittable& world, int max_depth, const color& background, uint64_t seed = 0, int first_sample = 0, irradiance_cache* cache = nullptr) {
+    color pixel_color(0, 0, 0);
+    for (int s = first_sample; s < first_sample + samples_per_pixel; ++s) {
+        seed_sample(seed, i, j, s);
+        auto u = (i + random_double()) / (image_width-1);
+        auto v = (j + random_double()) / (image_height-1);
+        ray r = cam.get_ray(u, v);
+        r.spread = cam.pixel_spread(image_height);
+        STAT_RAY(RAY_PRIMARY);
+        pixel_color += cache ? ray_color_cached(r, background, world, max_depth, *cache) : ray_color(r, background, world, max_depth);
+    }
+    return pixel_color;
+}
+
+framebuffer render_frame(const camera& cam, std::string num, int image_width, int image_height, int samples_per_pixel, const scene& world, int max_depth, color background, int time, irradiance_cache* cache = nullptr) {
+    framebuffer fb(image_width, image_height);
 
+    int last_percent = -1;
     for (int j = image_height-1; j >= 0; --j) {
-        std::cerr << "\r" + num + ": Scanlines remaining: " << j << ' ' << std::flush;
+        int percent = 100 * (image_height - 1 - j) / image_height;
+        if (percent != last_percent) {
+            std::cerr << "\r" + num + ": " << percent << "% " << std::flush;
+            last_percent = percent;
+        }
         for (int i = 0; i < image_width; ++i) {
-            color pixel_color(0, 0, 0);
-            for (int s = 0; s < samples_per_pixel; ++s) {
-                auto u = (i + random_double()) / (image_width-1);
-                auto v = (j + random_double()) / (image_height-1);
-                ray r = cam.get_ray(u, v);
-                pixel_color += ray_color(r, background, world, max_depth);
-            }
-            write_color(ppm, pixel_color, samples_per_pixel);
+            color pixel_color = render_pixel(cam, i, j, image_width, image_height, samples_per_pixel, world.root(), max_depth, background, 0, 0, cache);
+            fb.add(i, j, pixel_color, samples_per_pixel);
         }
     }
-    ppm.close();
+
     std::cerr << "\nDone: " + num + "\n";
+    return fb;
+}
+
+void render_image(const camera& cam, std::string num, int image_width, int image_height, int samples_per_pixel, const scene& world, int max_depth, color background, int time, image_format format = FORMAT_PPM, irradiance_cache* cache = nullptr) {
+    framebuffer fb = render_frame(cam, num, image_width, image_height, samples_per_pixel, world, max_depth, background, time, cache);
+    write_image("output/image" + num + image_extension(format), fb, format);
+}
+
+// Renders a frame and hands it to writer, or writes it as PPM right away without one.
+// Frames of a static scene can share one irradiance cache, each reusing what the ones
+// before it computed.
+void render_to_writer(frame_writer* writer, const camera& cam, std::string num, int image_width, int image_height, int samples_per_pixel, const scene& world, int max_depth, color background, int time, irradiance_cache* cache = nullptr) {
+    if (!writer) {
+        render_image(cam, num, image_width, image_height, samples_per_pixel, world, max_depth, background, time, FORMAT_PPM, cache);
+        return;
+    }
+    writer->submit(time, render_frame(cam, num, image_width, image_height, samples_per_pixel, world, max_depth, background, time, cache), "output/image" + num);
 }
 
-void render_multi_nothread(int image_num, point3 lookfrom, point3 lookat, point3 vup, double vfov, double aspect_ratio, double aperture, double dist_to_focus, int image_width, int image_height, int samples_per_pixel, hittable_list world, int max_depth, color background) {
+void render_multi_nothread(int image_num, point3 lookfrom, point3 lookat, point3 vup, double vfov, double aspect_ratio, double aperture, double dist_to_focus, int image_width, int image_height, int samples_per_pixel, const scene& world, int max_depth, color background, frame_writer* writer = nullptr) {
     for(int i = 0; i < image_num; i++) {
         /* auto lf = lookfrom - circle_motion(i); */
         auto lf = lookfrom;
         camera cam(lf, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus);
         std::string num = std::string(3 - std::to_string(i).length(), '0') + std::to_string(i);
-        render_image(cam, num, image_width, image_height, samples_per_pixel, world, max_depth, background, i);
+        render_to_writer(writer, cam, num, image_width, image_height, samples_per_pixel, world, max_depth, background, i);
     }
 }
 
-void render_multi_thread(int image_num, int thread_num, point3 lookfrom, point3 lookat, point3 vup, double vfov, double aspect_ratio, double aperture, double dist_to_focus, camera cam, int image_width, int image_height, int samples_per_pixel, hittable_list world, int max_depth, color background) {
-    for(int i = 0; i < std::ceil(image_num/thread_num); i++) {
-        std::vector<std::thread> all_threads;
-        for(int j = 0; j < thread_num; j++) {
-            camera cam(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus);
-            std::string num = std::string(3 - std::to_string((j + i*thread_num)).length(), '0') + std::to_string((j + i*thread_num));
-            std::thread t(render_image, cam, num, image_width, image_height, samples_per_pixel, world, max_depth, background, i*thread_num+j);
-            all_threads.push_back(std::move(t));
-        }
-        for(int j = 0; j < all_threads.size(); j++) {
-            all_threads[j].join();
+// Renders all frames on one persistent thread pool. Every frame is queued up front with
+// earlier frames first, so threads never wait for the slowest frame and finished frames
+// reach the writer in roughly their final order.
+void render_multi_thread(int image_num, int thread_num, point3 lookfrom, point3 lookat, point3 vup, double vfov, double aspect_ratio, double aperture, double dist_to_focus, camera cam, int image_width, int image_height, int samples_per_pixel, const scene& world, int max_depth, color background, frame_writer* writer = nullptr, irradiance_cache* cache = nullptr) {
+    render_pool pool(thread_num);
+
+    for(int i = 0; i < image_num; i++) {
+        camera frame_cam(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus);
+        std::string num = std::string(3 - std::to_string(i).length(), '0') + std::to_string(i);
+
+        auto job = std::make_shared<frame_job>();
+        job->width = image_width;
+        job->height = image_height;
+        job->priority = i;
+        job->render_tile = [=, &world](frame_job& f, const tile& t) {
+            for (int j = t.y0; j < t.y1; j++)
+            for (int x = t.x0; x < t.x1; x++) {
+                color pixel_color = render_pixel(frame_cam, x, j, image_width, image_height, samples_per_pixel, world.root(), max_depth, background, 0, 0, cache);
+                f.fb.add(x, j, pixel_color, samples_per_pixel);
+            }
         };
+        job->on_done = [=](frame_job& f) {
+            if (writer) {
+                writer->submit(i, std::move(f.fb), "output/image" + num);
+            } else {
+                write_image("output/image" + num + ".ppm", f.fb, FORMAT_PPM);
+            }
+            std::cerr << "Done: " + num + "\n";
+        };
+        pool.submit(job);
     }
+
+    pool.wait();
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,188 @@
+#ifndef RENDER_POOL_H
+#define RENDER_POOL_H
+
+#include "framebuffer.h"
+#include "tile_scheduler.h"
+#include "trace.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// A frame rendered by a render_pool. render_tile fills one tile of fb and is called
+// concurrently for different tiles, on_done runs once after the last tile finished.
+struct frame_job {
+    int width = 0;
+    int height = 0;
+    int priority = 0; // lower values are rendered first
+    framebuffer fb;
+
+    std::function<void(frame_job&, const tile&)> render_tile;
+    std::function<void(frame_job&)> on_done;
+
+    std::atomic<int> tiles_left{0};
+};
+
+// Persistent set of render threads fed with the tiles of every pending frame.
+//
+// Submitted frames wait in a queue ordered by priority and submission order. Their
+// tiles go through a tile_scheduler, one frame at a time: whichever worker runs out of
+// tiles admits the next frame, so threads move on to it while the last tiles of the
+// current one finish, and a frame of higher priority overtakes every frame that hasn't
+// started yet. The pool's own lock is only taken per frame, never per tile.
+class render_pool {
+    public:
+        explicit render_pool(unsigned threads = default_thread_count(), int tile_sz = 32, tile_order ord = ORDER_HILBERT)
+            : scheduler(threads), tile_size(tile_sz), order(ord)
+        {
+            for (unsigned i = 0; i < scheduler.worker_count(); i++) {
+                workers.emplace_back([this, i] {
+                    trace_thread_name("pool " + std::to_string(i));
+                    worker(i);
+                });
+            }
+        }
+
+        ~render_pool() {
+            {
+                std::lock_guard<std::mutex> lock(m);
+                stopping = true;
+            }
+            work_available.notify_all();
+            for (auto& t : workers) t.join();
+        }
+
+        render_pool(const render_pool&) = delete;
+        render_pool& operator=(const render_pool&) = delete;
+
+        unsigned thread_count() const { return static_cast<unsigned>(workers.size()); }
+
+        void submit(std::shared_ptr<frame_job> job) {
+            if (job->fb.width != job->width || job->fb.height != job->height) {
+                job->fb = framebuffer(job->width, job->height);
+            }
+
+            const bool empty = job->width <= 0 || job->height <= 0;
+            {
+                std::lock_guard<std::mutex> lock(m);
+                pending_frames++;
+                if (!empty) waiting.push(waiting_frame{job->priority, next_seq++, job});
+            }
+            if (empty) {
+                if (job->on_done) job->on_done(*job);
+                std::lock_guard<std::mutex> lock(m);
+                finish_frame_locked();
+                return;
+            }
+            work_available.notify_all();
+        }
+
+        // Blocks until every submitted frame is finished.
+        void wait() {
+            std::unique_lock<std::mutex> lock(m);
+            all_done.wait(lock, [&] { return pending_frames == 0; });
+        }
+
+    private:
+        struct waiting_frame {
+            int priority;
+            size_t seq;
+            std::shared_ptr<frame_job> job;
+
+            // std::priority_queue pops the largest element first
+            bool operator<(const waiting_frame& o) const {
+                if (priority != o.priority) return priority > o.priority;
+                return seq > o.seq;
+            }
+        };
+
+        void worker(unsigned id) {
+            // the frame of the last tile, so the job is only looked up when that changes
+            std::shared_ptr<frame_job> job;
+            int job_id = -1;
+
+            while (true) {
+                const size_t seen = admitted.load();
+                tile t;
+                if (!scheduler.next(id, t)) {
+                    job.reset();
+                    job_id = -1;
+
+                    trace_span span("wait", "scheduler");
+                    std::unique_lock<std::mutex> lock(m);
+                    work_available.wait(lock, [&] { return stopping || !waiting.empty() || admitted.load() != seen; });
+                    // another worker may have queued tiles in the meantime
+                    if (admitted.load() != seen) continue;
+                    if (waiting.empty()) return;
+                    admit_locked();
+                    continue;
+                }
+
+                if (t.frame != job_id) {
+                    std::lock_guard<std::mutex> lock(m);
+                    job = active.at(t.frame);
+                    job_id = t.frame;
+                }
+
+                {
+                    trace_span span("tile", "render", job->priority, t.x0, t.y0);
+                    job->render_tile(*job, t);
+                }
+
+                if (--job->tiles_left == 0) {
+                    trace_span span("frame done", "render", job->priority);
+                    if (job->on_done) job->on_done(*job);
+                    std::lock_guard<std::mutex> lock(m);
+                    active.erase(job_id);
+                    finish_frame_locked();
+                }
+            }
+        }
+
+        // Hands the tiles of the first waiting frame to the scheduler.
+        void admit_locked() {
+            std::shared_ptr<frame_job> job = waiting.top().job;
+            waiting.pop();
+
+            const int id = next_id++;
+            const int columns = (job->width + tile_size - 1) / tile_size;
+            const int rows = (job->height + tile_size - 1) / tile_size;
+            job->tiles_left = columns * rows;
+            active[id] = job;
+            scheduler.add_frame(job->width, job->height, tile_size, order, id);
+
+            // after the tiles are queued, so a worker that sees the new count also finds them
+            admitted++;
+            work_available.notify_all();
+        }
+
+        void finish_frame_locked() {
+            if (--pending_frames == 0) all_done.notify_all();
+        }
+
+    private:
+        tile_scheduler scheduler;
+        int tile_size;
+        tile_order order;
+
+        std::mutex m;
+        std::condition_variable work_available;
+        std::condition_variable all_done;
+        std::priority_queue<waiting_frame> waiting;
+        std::map<int, std::shared_ptr<frame_job>> active; // admitted frames by tile.frame
+        size_t next_seq = 0;
+        int next_id = 0;
+        std::atomic<size_t> admitted{0};
+        size_t pending_frames = 0;
+        bool stopping = false;
+
+        std::vector<std::thread> workers;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define RTWEEKEND_H
 
 #include <cmath>
+#include <cstdint>
 #include <limits>
 #include <memory>
 #include <random>
@@ -17,9 +18,37 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
+// Every thread has its own generator state, so threads never contend on a lock
+// and the sequence a thread sees only depends on how it was seeded.
+inline uint64_t& random_state() {
+    thread_local uint64_t state = 0x853c49e6748fea9bULL;
+    return state;
+}
+
+inline uint64_t splitmix64(uint64_t& x) {
+    uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+inline void seed_random(uint64_t seed) {
+    random_state() = seed;
+}
+
+// Seeds the generator from the frame seed, pixel and sample index. A sample then
+// produces the same path no matter which thread, tile or process renders it.
+inline void seed_sample(uint64_t seed, int x, int y, int sample) {
+    uint64_t key = seed;
+    key = splitmix64(key) ^ static_cast<uint32_t>(x);
+    key = splitmix64(key) ^ static_cast<uint32_t>(y);
+    key = splitmix64(key) ^ static_cast<uint32_t>(sample);
+    random_state() = splitmix64(key);
+}
+
 inline double random_double() {
     // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
+    return (splitmix64(random_state()) >> 11) * (1.0 / 9007199254740992.0);
 }
 
 inline double random_double(double min, double max) {
@@ -39,6 +68,7 @@ inline int random_int(int min, int max) {
 }
 
 #include "ray.h"
+#include "stats.h"
 #include "vec3.h"
 
 #endif
\ No newline at end of file
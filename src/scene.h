@@ -0,0 +1,162 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+// A finished, read-only scene. It is only created by scene_builder::commit and has no
+// mutating members, so one instance can be shared by every render thread and frame
+// through a const reference without locks or per-thread copies.
+class scene {
+    public:
+        // The object rays are traced against.
+        const hittable& root() const { return *world; }
+
+        const std::vector<shared_ptr<hittable>>& objects() const { return top_level; }
+        const std::vector<shared_ptr<hittable>>& lights() const { return light_list; }
+        const std::vector<shared_ptr<material>>& materials() const { return material_list; }
+
+        // the interval the bounds of moving objects were built for
+        double time0() const { return shutter_open; }
+        double time1() const { return shutter_close; }
+
+    private:
+        friend class scene_builder;
+        scene() {}
+
+        shared_ptr<hittable> world;
+        std::vector<shared_ptr<hittable>> top_level;
+        std::vector<shared_ptr<hittable>> light_list;
+        std::vector<shared_ptr<material>> material_list;
+        double shutter_open = 0, shutter_close = 1;
+};
+
+// Tags hits on a top-level object with its index, for the object id AOV.
+class scene_object : public hittable {
+    public:
+        scene_object(shared_ptr<hittable> obj, int object_id) : object(obj), id(object_id) {}
+
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+            if (!object->hit(r, t_min, t_max, rec)) return false;
+            rec.object_id = id;
+            return true;
+        }
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+            return object->bounding_box(time0, time1, output_box);
+        }
+
+        virtual bool motion_bounds(double time0, double time1, aabb& box0, aabb& box1) const override {
+            return object->motion_bounds(time0, time1, box0, box1);
+        }
+
+    public:
+        shared_ptr<hittable> object;
+        int id;
+};
+
+// Collects geometry, lights and materials on a single thread. commit() turns them into
+// an immutable scene and leaves the builder empty, ready for the next scene.
+class scene_builder {
+    public:
+        scene_builder() {}
+        explicit scene_builder(const hittable_list& list) : objects(list.objects) {}
+
+        scene_builder& add(shared_ptr<hittable> object) {
+            objects.push_back(object);
+            return *this;
+        }
+
+        // Lights are regular geometry that is also remembered for light sampling.
+        scene_builder& add_light(shared_ptr<hittable> light) {
+            objects.push_back(light);
+            lights.push_back(light);
+            return *this;
+        }
+
+        shared_ptr<material> add_material(shared_ptr<material> m) {
+            materials.push_back(m);
+            return m;
+        }
+
+        // time0 and time1 must cover the shutter of every camera the scene is seen with,
+        // as the BVH only bounds moving objects within them.
+        shared_ptr<const scene> commit(double time0 = 0, double time1 = 1) {
+            trace_span span("scene build", "scene");
+            shared_ptr<scene> s(new scene());
+
+            s->world = build_root(objects, time0, time1);
+            s->shutter_open = time0;
+            s->shutter_close = time1;
+
+            s->top_level = std::move(objects);
+            s->light_list = std::move(lights);
+            s->material_list = std::move(materials);
+
+            objects.clear();
+            lights.clear();
+            materials.clear();
+            return s;
+        }
+
+    private:
+        // Objects larger than this many times the median object are kept out of the BVH.
+        static constexpr double huge_factor = 50.0;
+
+        static double largest_extent(const aabb& box) {
+            vec3 d = box.max() - box.min();
+            return fmax(d.x(), fmax(d.y(), d.z()));
+        }
+
+        // A BVH over the top-level objects, next to a plain list of the ones without a
+        // bounding box or so large (ground spheres, fog around the whole scene) that
+        // they would make every node of the tree overlap with everything else.
+        static shared_ptr<hittable> build_root(const std::vector<shared_ptr<hittable>>& objects, double time0, double time1) {
+            std::vector<shared_ptr<hittable>> tagged;
+            std::vector<double> extents;
+            for (size_t i = 0; i < objects.size(); i++) {
+                tagged.push_back(make_shared<scene_object>(objects[i], static_cast<int>(i)));
+                aabb box;
+                extents.push_back(objects[i]->bounding_box(time0, time1, box) ? largest_extent(box) : infinity);
+            }
+
+            std::vector<double> sorted = extents;
+            std::sort(sorted.begin(), sorted.end());
+            const double median = sorted.empty() ? 0.0 : sorted[sorted.size() / 2];
+
+            auto root = make_shared<hittable_list>();
+            std::vector<shared_ptr<hittable>> bounded;
+            for (size_t i = 0; i < tagged.size(); i++) {
+                if (extents[i] == infinity || (median > 0 && extents[i] > huge_factor * median)) {
+                    root->add(tagged[i]);
+                } else {
+                    bounded.push_back(tagged[i]);
+                }
+            }
+
+            if (bounded.size() > 2) {
+                root->add(make_shared<bvh_node>(bounded, 0, bounded.size(), time0, time1));
+            } else {
+                for (auto& b : bounded) root->add(b);
+            }
+
+            if (root->objects.size() == 1) return root->objects[0];
+            return root;
+        }
+
+    private:
+        std::vector<shared_ptr<hittable>> objects;
+        std::vector<shared_ptr<hittable>> lights;
+        std::vector<shared_ptr<material>> materials;
+};
+
+#endif
@@ -0,0 +1,308 @@
+#ifndef SD_TREE_H
+#define SD_TREE_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Path guiding with a spatial-directional tree, after Müller, Gross and Novák's
+// "Practical Path Guiding". A binary tree splits the scene bounds into regions, and every
+// region holds a quadtree over the sphere of directions that learns where incident light
+// comes from. Directions map to the unit square with the equal-area cylindrical
+// projection (cos theta, phi), so quadtree areas are proportional to solid angles.
+//
+// Every region keeps two quadtrees: one that paths are sampled from, and one that
+// collects the radiance they find. Recording only adds to atomic floats, so render
+// threads never lock. Between passes, refine() turns the collected quadtrees into the
+// new sampling ones and splits busy regions. Rather than starting each pass from zero,
+// the new collecting quadtrees keep a fraction of what the last ones held, which smooths
+// the guide over passes without letting early, noisy passes dominate it.
+
+inline void atomic_add(std::atomic<float>& a, float value) {
+    float old = a.load(std::memory_order_relaxed);
+    while (!a.compare_exchange_weak(old, old + value, std::memory_order_relaxed)) {}
+}
+
+class direction_tree {
+    public:
+        direction_tree() : nodes(1) {}
+
+        direction_tree(const direction_tree& other) : nodes(other.nodes) {}
+        direction_tree& operator=(const direction_tree& other) {
+            nodes = other.nodes;
+            return *this;
+        }
+
+        double total() const { return nodes[0].total(); }
+
+        void record(const vec3& direction, float value) {
+            double u, v;
+            to_square(direction, u, v);
+            uint32_t n = 0;
+            while (true) {
+                const int q = quadrant(u, v);
+                atomic_add(nodes[n].sum[q], value);
+                if (nodes[n].child[q] == 0) return;
+                n = nodes[n].child[q];
+            }
+        }
+
+        // Picks a direction in proportion to the recorded radiance, returning its solid
+        // angle density.
+        vec3 sample(double& pdf) const {
+            double u = random_double(), v = random_double();
+            double p = 1;
+            double x0 = 0, y0 = 0, size = 1;
+            uint32_t n = 0;
+            while (true) {
+                const node& nd = nodes[n];
+                const double t = nd.total();
+                int q = 3;
+                double pick = u * t;
+                for (int i = 0; i < 3; i++) {
+                    const double s = nd.sum[i].load(std::memory_order_relaxed);
+                    if (pick < s) { q = i; break; }
+                    pick -= s;
+                }
+                const double s = nd.sum[q].load(std::memory_order_relaxed);
+                // reuse what is left of u for the next level
+                u = s > 0 ? fmin(pick / s, 1 - 1e-12) : random_double();
+                p *= 4 * s / t;
+                size *= 0.5;
+                x0 += (q & 1) * size;
+                y0 += (q >> 1) * size;
+                if (nd.child[q] == 0) break;
+                n = nd.child[q];
+            }
+            pdf = p / (4 * pi);
+            return from_square(x0 + random_double() * size, y0 + v * size);
+        }
+
+        double pdf(const vec3& direction) const {
+            double u, v;
+            to_square(direction, u, v);
+            double p = 1;
+            uint32_t n = 0;
+            while (true) {
+                const node& nd = nodes[n];
+                const double t = nd.total();
+                if (t <= 0) return 0;
+                const int q = quadrant(u, v);
+                p *= 4 * nd.sum[q].load(std::memory_order_relaxed) / t;
+                if (nd.child[q] == 0) break;
+                n = nd.child[q];
+            }
+            return p / (4 * pi);
+        }
+
+        // A copy of this tree with leaves split where they hold more than threshold of
+        // the energy, down to max_depth levels. The energy of a split quadrant is spread
+        // evenly over its children, so the copy keeps learning from what this one knew.
+        direction_tree refined(double threshold, double carry, int max_depth = 20) const {
+            direction_tree out;
+            const double t = total();
+            if (t > 0) out.refine_node(*this, 0, 0, t, threshold * t, carry, 1, max_depth);
+            return out;
+        }
+
+    private:
+        struct node {
+            std::atomic<float> sum[4];
+            uint32_t child[4];
+
+            node() {
+                for (int i = 0; i < 4; i++) { sum[i] = 0.0f; child[i] = 0; }
+            }
+            node(const node& other) {
+                for (int i = 0; i < 4; i++) {
+                    sum[i] = other.sum[i].load(std::memory_order_relaxed);
+                    child[i] = other.child[i];
+                }
+            }
+            node& operator=(const node& other) {
+                for (int i = 0; i < 4; i++) {
+                    sum[i] = other.sum[i].load(std::memory_order_relaxed);
+                    child[i] = other.child[i];
+                }
+                return *this;
+            }
+
+            double total() const {
+                double t = 0;
+                for (int i = 0; i < 4; i++) t += sum[i].load(std::memory_order_relaxed);
+                return t;
+            }
+        };
+
+        // Quadrant of (u, v) in the current node, rescaling both into the quadrant.
+        static int quadrant(double& u, double& v) {
+            const int qx = u >= 0.5, qy = v >= 0.5;
+            u = 2 * u - qx;
+            v = 2 * v - qy;
+            return qx | (qy << 1);
+        }
+
+        static void to_square(const vec3& d, double& u, double& v) {
+            const vec3 n = unit_vector(d);
+            u = clamp(0.5 * (n.z() + 1), 0.0, 1 - 1e-12);
+            double phi = std::atan2(n.y(), n.x());
+            if (phi < 0) phi += 2 * pi;
+            v = clamp(phi / (2 * pi), 0.0, 1 - 1e-12);
+        }
+
+        static vec3 from_square(double u, double v) {
+            const double cos_theta = 2 * u - 1;
+            const double sin_theta = sqrt(fmax(0.0, 1 - cos_theta * cos_theta));
+            const double phi = 2 * pi * v;
+            return vec3(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+        }
+
+        // Adds children below node n for its quadrants holding more than threshold energy.
+        // The energies come from the matching node src_node of src or, where src is coarser
+        // (src_node < 0), from spreading energy evenly over the quadrants.
+        void refine_node(const direction_tree& src, uint32_t n, int64_t src_node, double energy,
+            double threshold, double carry, int depth, int max_depth)
+        {
+            for (int q = 0; q < 4; q++) {
+                double e = energy / 4;
+                int64_t next = -1;
+                if (src_node >= 0) {
+                    e = src.nodes[src_node].sum[q].load(std::memory_order_relaxed);
+                    if (src.nodes[src_node].child[q] != 0) next = src.nodes[src_node].child[q];
+                }
+                nodes[n].sum[q] = static_cast<float>(e * carry);
+                if (e <= threshold || depth >= max_depth) continue;
+
+                const uint32_t c = static_cast<uint32_t>(nodes.size());
+                nodes.emplace_back();
+                nodes[n].child[q] = c;
+                refine_node(src, c, next, e, threshold, carry, depth + 1, max_depth);
+            }
+        }
+
+    private:
+        std::vector<node> nodes;
+};
+
+class sd_tree {
+    public:
+        // split_records is the number of recorded paths after which a region splits in two.
+        sd_tree(const aabb& bounds, uint32_t split_records = 12000)
+            : box(bounds), split_threshold(split_records)
+        {
+            nodes.push_back(spatial_node{0, {0, 0}, 0});
+            leaves.push_back(std::unique_ptr<region>(new region()));
+        }
+
+        sd_tree(const sd_tree&) = delete;
+        sd_tree& operator=(const sd_tree&) = delete;
+
+        // Samples a guided direction at p. Returns false where nothing has been learnt yet.
+        bool sample(const point3& p, vec3& direction, double& pdf) const {
+            const region& r = *leaves[find(p)];
+            if (r.sampling.total() <= 0) return false;
+            direction = r.sampling.sample(pdf);
+            return true;
+        }
+
+        double pdf(const point3& p, const vec3& direction) const {
+            const region& r = *leaves[find(p)];
+            return r.sampling.total() > 0 ? r.sampling.pdf(direction) : 0.0;
+        }
+
+        bool trained(const point3& p) const {
+            return leaves[find(p)]->sampling.total() > 0;
+        }
+
+        // Adds radiance arriving at p from direction (the direction of travel reversed),
+        // already divided by the density it was sampled with.
+        void record(const point3& p, const vec3& direction, double radiance) {
+            region& r = *leaves[find(p)];
+            r.records.fetch_add(1, std::memory_order_relaxed);
+            if (radiance > 0 && std::isfinite(radiance)) r.recording.record(direction, static_cast<float>(radiance));
+        }
+
+        // Starts using what was recorded since the last call. Must not run concurrently
+        // with sample, pdf or record.
+        void refine(double energy_threshold = 0.01, double carry = 0.25) {
+            // split regions that saw many paths, assuming they spread evenly over the halves
+            for (size_t i = 0; i < nodes.size(); i++) {
+                if (nodes[i].leaf < 0) continue;
+                const uint32_t count = leaves[nodes[i].leaf]->records.load();
+                if (count <= split_threshold || nodes[i].depth >= 48) continue;
+                split(i, count / 2);
+                i--; // revisit the node, which is now interior, to look at the new children
+            }
+
+            for (auto& r : leaves) {
+                r->sampling = r->recording;
+                r->recording = r->sampling.refined(energy_threshold, carry);
+                r->records = 0;
+            }
+            iteration++;
+        }
+
+        int iterations() const { return iteration; }
+        size_t region_count() const { return leaves.size(); }
+
+    private:
+        struct region {
+            direction_tree sampling;
+            direction_tree recording;
+            std::atomic<uint32_t> records{0};
+        };
+
+        struct spatial_node {
+            int leaf;        // index into leaves, -1 for interior nodes
+            uint32_t child[2];
+            int depth;       // the split axis is depth % 3
+        };
+
+        size_t find(const point3& p) const {
+            point3 lo = box.min(), hi = box.max();
+            uint32_t n = 0;
+            while (nodes[n].leaf < 0) {
+                const int axis = nodes[n].depth % 3;
+                const double mid = 0.5 * (lo[axis] + hi[axis]);
+                if (p[axis] < mid) { hi[axis] = mid; n = nodes[n].child[0]; }
+                else { lo[axis] = mid; n = nodes[n].child[1]; }
+            }
+            return nodes[n].leaf;
+        }
+
+        // Turns leaf node n into two leaves that both start from its quadtrees.
+        void split(size_t n, uint32_t records) {
+            const int old_leaf = nodes[n].leaf;
+            const int depth = nodes[n].depth;
+            const direction_tree sampling = leaves[old_leaf]->sampling;
+            const direction_tree recording = leaves[old_leaf]->recording;
+
+            for (int c = 0; c < 2; c++) {
+                int leaf = old_leaf;
+                if (c == 1) {
+                    leaf = static_cast<int>(leaves.size());
+                    leaves.push_back(std::unique_ptr<region>(new region()));
+                }
+                leaves[leaf]->sampling = sampling;
+                leaves[leaf]->recording = recording;
+                leaves[leaf]->records = records;
+                nodes[n].child[c] = static_cast<uint32_t>(nodes.size());
+                nodes.push_back(spatial_node{leaf, {0, 0}, depth + 1});
+            }
+            nodes[n].leaf = -1;
+        }
+
+    private:
+        aabb box;
+        uint32_t split_threshold;
+        std::vector<spatial_node> nodes;
+        std::vector<std::unique_ptr<region>> leaves;
+        int iteration = 0;
+};
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include "rtweekend.h"
+
+// Spectral rendering with hero wavelength sampling. Every path carries spectral_lanes
+// wavelengths: a randomly chosen hero and the others spaced evenly after it, wrapping
+// around the visible range. Values along the path are kept per lane in a spectrum,
+// whose fixed size loops the compiler turns into vector instructions, so four
+// wavelengths cost about as much as one.
+//
+// The scene itself stays rgb. Colors are turned into smooth spectra where they are
+// used, and the lanes are turned back into rgb when the path is done. White maps to a
+// flat spectrum and back to white.
+
+const int spectral_lanes = 4;
+const double lambda_min = 380.0; // nm
+const double lambda_max = 780.0;
+
+struct alignas(32) spectrum {
+    double v[spectral_lanes];
+
+    spectrum() {}
+    explicit spectrum(double x) {
+        for (int i = 0; i < spectral_lanes; i++) v[i] = x;
+    }
+
+    double operator[](int i) const { return v[i]; }
+    double& operator[](int i) { return v[i]; }
+
+    spectrum& operator+=(const spectrum& s) {
+        for (int i = 0; i < spectral_lanes; i++) v[i] += s.v[i];
+        return *this;
+    }
+
+    spectrum& operator*=(const spectrum& s) {
+        for (int i = 0; i < spectral_lanes; i++) v[i] *= s.v[i];
+        return *this;
+    }
+};
+
+inline spectrum operator+(const spectrum& a, const spectrum& b) {
+    spectrum s = a;
+    return s += b;
+}
+
+inline spectrum operator*(const spectrum& a, const spectrum& b) {
+    spectrum s = a;
+    return s *= b;
+}
+
+// The wavelengths of one path. Once a wavelength dependent event, like refraction
+// through dispersive glass, sends the path along the hero's direction, the other lanes
+// no longer describe valid paths and only the hero counts.
+struct wavelengths {
+    double lambda[spectral_lanes];
+    bool secondary_terminated = false;
+
+    double hero() const { return lambda[0]; }
+};
+
+inline wavelengths sample_wavelengths(double u) {
+    wavelengths wl;
+    const double range = lambda_max - lambda_min;
+    for (int i = 0; i < spectral_lanes; i++) {
+        const double offset = u * range + i * range / spectral_lanes;
+        wl.lambda[i] = lambda_min + (offset < range ? offset : offset - range);
+    }
+    return wl;
+}
+
+// CIE 1931 colour matching functions, in the multi-lobe gaussian fit of Wyman, Sloan
+// and Shirley.
+inline double cie_lobe(double lambda, double mu, double sigma_below, double sigma_above) {
+    const double t = (lambda - mu) / (lambda < mu ? sigma_below : sigma_above);
+    return std::exp(-0.5 * t * t);
+}
+
+inline vec3 cie_xyz(double lambda) {
+    return vec3(
+        1.056 * cie_lobe(lambda, 599.8, 37.9, 31.0) + 0.362 * cie_lobe(lambda, 442.0, 16.0, 26.7) - 0.065 * cie_lobe(lambda, 501.1, 20.4, 26.2),
+        0.821 * cie_lobe(lambda, 568.8, 46.9, 40.5) + 0.286 * cie_lobe(lambda, 530.9, 16.3, 31.1),
+        1.217 * cie_lobe(lambda, 437.0, 11.8, 36.0) + 0.681 * cie_lobe(lambda, 459.0, 26.0, 13.8));
+}
+
+inline vec3 xyz_to_linear_srgb(const vec3& c) {
+    return vec3(
+         3.2406 * c.x() - 1.5372 * c.y() - 0.4986 * c.z(),
+        -0.9689 * c.x() + 1.8758 * c.y() + 0.0415 * c.z(),
+         0.0557 * c.x() - 0.2040 * c.y() + 1.0570 * c.z());
+}
+
+// Smooth blue, green and red basis spectra that sum to one.
+inline vec3 spectral_basis(double lambda) {
+    const double b = 1 / (1 + std::exp((lambda - 490.0) / 12.0));
+    const double r = 1 / (1 + std::exp(-(lambda - 595.0) / 12.0));
+    return vec3(r, 1 - r - b, b);
+}
+
+struct spectral_tables {
+    vec3 white;              // rgb of a flat spectrum, before white balancing
+    double to_basis[3][3];   // rgb to basis weights
+};
+
+// The rgb each basis spectrum integrates to, inverted once.
+inline const spectral_tables& spectral_conversion() {
+    static const spectral_tables tables = [] {
+        spectral_tables t;
+        vec3 white(0,0,0);
+        vec3 response[3] = {vec3(0,0,0), vec3(0,0,0), vec3(0,0,0)};
+        for (double lambda = lambda_min + 0.5; lambda < lambda_max; lambda += 1.0) {
+            const vec3 rgb = xyz_to_linear_srgb(cie_xyz(lambda));
+            const vec3 basis = spectral_basis(lambda);
+            white += rgb;
+            for (int j = 0; j < 3; j++) response[j] += basis[j] * rgb;
+        }
+        t.white = white;
+
+        // m[i][j] is the white balanced channel i of basis j
+        double m[3][3];
+        for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++) m[i][j] = response[j][i] / white[i];
+
+        const double det = m[0][0] * (m[1][1]*m[2][2] - m[1][2]*m[2][1])
+                         - m[0][1] * (m[1][0]*m[2][2] - m[1][2]*m[2][0])
+                         + m[0][2] * (m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+        for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++) {
+            // cofactor of m[j][i]
+            const int r0 = (j + 1) % 3, r1 = (j + 2) % 3, c0 = (i + 1) % 3, c1 = (i + 2) % 3;
+            t.to_basis[i][j] = (m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0]) / det;
+        }
+        return t;
+    }();
+    return tables;
+}
+
+// A smooth spectrum that integrates back to c, sampled at the path's wavelengths.
+// Saturated colors can call for negative values, those are clamped to zero.
+inline spectrum rgb_to_spectrum(const color& c, const wavelengths& wl) {
+    const spectral_tables& t = spectral_conversion();
+    double w[3];
+    for (int i = 0; i < 3; i++) w[i] = t.to_basis[i][0] * c[0] + t.to_basis[i][1] * c[1] + t.to_basis[i][2] * c[2];
+
+    spectrum s;
+    for (int i = 0; i < spectral_lanes; i++) {
+        const vec3 basis = spectral_basis(wl.lambda[i]);
+        s[i] = fmax(w[0] * basis[0] + w[1] * basis[1] + w[2] * basis[2], 0.0);
+    }
+    return s;
+}
+
+// The rgb estimate of one path's spectrum. Each lane is a sample of the uniform
+// wavelength distribution, so together they average their colour matching responses.
+inline color spectrum_to_rgb(const spectrum& s, const wavelengths& wl) {
+    const spectral_tables& t = spectral_conversion();
+    const double range = lambda_max - lambda_min;
+    const int lanes = wl.secondary_terminated ? 1 : spectral_lanes;
+
+    vec3 rgb(0,0,0);
+    for (int i = 0; i < lanes; i++) rgb += s[i] * xyz_to_linear_srgb(cie_xyz(wl.lambda[i]));
+    rgb *= range / lanes;
+    return color(rgb[0] / t.white[0], rgb[1] / t.white[1], rgb[2] / t.white[2]);
+}
+
+#endif
@@ -12,6 +12,30 @@ class sphere : public hittable {
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 
+        virtual bool intervals(const ray& r, double t_min, double t_max, ray_intervals& out) const override {
+            STAT_PRIMITIVE(PRIM_SPHERE);
+            vec3 oc = r.origin() - center;
+            auto a = r.direction().length_squared();
+            auto half_b = dot(oc, r.direction());
+            auto c = oc.length_squared() - radius*radius;
+
+            auto discriminant = half_b*half_b - a*c;
+            if (discriminant < 0) { return true; }
+            auto sqrtd = sqrt(discriminant);
+            return out.add(fmax((-half_b - sqrtd) / a, t_min), fmin((-half_b + sqrtd) / a, t_max));
+        }
+
+        virtual bool sample_surface(hit_record& rec, double& area) const override {
+            const vec3 outward_normal = random_unit_vector();
+            rec.p = center + radius * outward_normal;
+            rec.normal = outward_normal;
+            rec.front_face = true;
+            get_sphere_uv(outward_normal, rec.u, rec.v);
+            rec.mat_ptr = mat_ptr;
+            area = 4 * pi * radius * radius;
+            return true;
+        }
+
     public:
         point3 center;
         double radius;
@@ -42,6 +66,7 @@ bool sphere::bounding_box(double time0, double time1, aabb& output_box) const {
 }
 
 bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    STAT_PRIMITIVE(PRIM_SPHERE);
     vec3 oc = r.origin() - center;
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
@@ -63,6 +88,8 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
     vec3 outward_normal = (rec.p - center) / radius;
     rec.set_face_normal(r, outward_normal);
     get_sphere_uv(outward_normal, rec.u, rec.v);
+    // u runs once around the equator and v from pole to pole, take the mean scale
+    rec.uv_scale = 1 / (pi * sqrt(2.0) * radius);
     rec.mat_ptr = mat_ptr;
 
     return true;
@@ -0,0 +1,138 @@
+#ifndef STATS_H
+#define STATS_H
+
+// Hot path counters. They only exist when compiled with -DRT_STATS (make STATS=1),
+// otherwise every STAT_* macro expands to nothing.
+//
+// Each thread counts into its own thread_local render_stats, so counting is a plain
+// increment. A thread's counters are merged into the global total when it exits;
+// stats_total() adds the calling thread's live counters on top.
+
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+
+enum stat_ray_type { RAY_PRIMARY, RAY_SCATTER, RAY_TYPE_COUNT };
+enum stat_primitive { PRIM_SPHERE, PRIM_LENS, PRIM_RECT, PRIM_MEDIUM, PRIM_COUNT };
+enum stat_material { MAT_LAMBERTIAN, MAT_METAL, MAT_DIELECTRIC, MAT_DIFFUSE_LIGHT, MAT_ISOTROPIC, MAT_COUNT };
+enum stat_termination { TERM_MISS, TERM_ABSORBED, TERM_MAX_DEPTH, TERM_COUNT };
+
+const int stat_max_path_length = 64;
+
+#ifdef RT_STATS
+const bool stats_enabled = true;
+#else
+const bool stats_enabled = false;
+#endif
+
+struct render_stats {
+    uint64_t rays[RAY_TYPE_COUNT] = {};
+    uint64_t bvh_nodes_visited = 0;
+    uint64_t primitive_tests[PRIM_COUNT] = {};
+    uint64_t scatter_calls[MAT_COUNT] = {};
+    uint64_t terminations[TERM_COUNT] = {};
+    uint64_t path_lengths[stat_max_path_length + 1] = {}; // last bin holds longer paths
+    int current_path_length = 0;
+
+    void add(const render_stats& o) {
+        for (int i = 0; i < RAY_TYPE_COUNT; i++) rays[i] += o.rays[i];
+        bvh_nodes_visited += o.bvh_nodes_visited;
+        for (int i = 0; i < PRIM_COUNT; i++) primitive_tests[i] += o.primitive_tests[i];
+        for (int i = 0; i < MAT_COUNT; i++) scatter_calls[i] += o.scatter_calls[i];
+        for (int i = 0; i < TERM_COUNT; i++) terminations[i] += o.terminations[i];
+        for (int i = 0; i <= stat_max_path_length; i++) path_lengths[i] += o.path_lengths[i];
+    }
+
+    // Traversal work so far: nodes visited plus primitives tested. Used for cost heat maps.
+    uint64_t traversal_cost() const {
+        uint64_t cost = bvh_nodes_visited;
+        for (int i = 0; i < PRIM_COUNT; i++) cost += primitive_tests[i];
+        return cost;
+    }
+};
+
+inline std::mutex& stats_mutex() {
+    static std::mutex m;
+    return m;
+}
+
+inline render_stats& stats_retired() {
+    static render_stats total;
+    return total;
+}
+
+// Owns a thread's counters and hands them to the global total when the thread ends.
+struct thread_stats {
+    render_stats counters;
+
+    ~thread_stats() {
+        std::lock_guard<std::mutex> guard{stats_mutex()};
+        stats_retired().add(counters);
+    }
+};
+
+inline render_stats& stats_local() {
+    thread_local thread_stats local;
+    return local.counters;
+}
+
+// Counters of all finished threads plus the calling one.
+inline render_stats stats_total() {
+    std::lock_guard<std::mutex> guard{stats_mutex()};
+    render_stats total = stats_retired();
+    total.add(stats_local());
+    return total;
+}
+
+void print_stats(std::ostream& out, const render_stats& s) {
+    const char* ray_names[RAY_TYPE_COUNT] = {"primary", "scatter"};
+    const char* prim_names[PRIM_COUNT] = {"sphere", "lens", "rect", "medium"};
+    const char* mat_names[MAT_COUNT] = {"lambertian", "metal", "dielectric", "diffuse_light", "isotropic"};
+    const char* term_names[TERM_COUNT] = {"miss", "absorbed", "max_depth"};
+
+    uint64_t total_rays = 0;
+    for (int i = 0; i < RAY_TYPE_COUNT; i++) total_rays += s.rays[i];
+
+    out << "rays:";
+    for (int i = 0; i < RAY_TYPE_COUNT; i++) out << " " << ray_names[i] << "=" << s.rays[i];
+    out << "\nbvh nodes visited: " << s.bvh_nodes_visited
+        << " (" << (total_rays ? double(s.bvh_nodes_visited) / total_rays : 0.0) << " per ray)\n";
+    out << "primitive tests:";
+    for (int i = 0; i < PRIM_COUNT; i++) out << " " << prim_names[i] << "=" << s.primitive_tests[i];
+    out << "\nscatter calls:";
+    for (int i = 0; i < MAT_COUNT; i++) out << " " << mat_names[i] << "=" << s.scatter_calls[i];
+    out << "\npath termination:";
+    for (int i = 0; i < TERM_COUNT; i++) out << " " << term_names[i] << "=" << s.terminations[i];
+    out << "\npath length histogram:";
+    for (int i = 0; i <= stat_max_path_length; i++) {
+        if (s.path_lengths[i]) out << " " << i << (i == stat_max_path_length ? "+" : "") << ":" << s.path_lengths[i];
+    }
+    out << "\n";
+}
+
+#ifdef RT_STATS
+    #define STAT_RAY(type) do { \
+            render_stats& st_ = stats_local(); \
+            st_.rays[type]++; \
+            st_.current_path_length = (type) == RAY_PRIMARY ? 0 : st_.current_path_length + 1; \
+        } while (0)
+    #define STAT_BVH_NODE() (stats_local().bvh_nodes_visited++)
+    #define STAT_PRIMITIVE(prim) (stats_local().primitive_tests[prim]++)
+    #define STAT_SCATTER(mat) (stats_local().scatter_calls[mat]++)
+    #define STAT_PATH_END(reason) do { \
+            render_stats& st_ = stats_local(); \
+            st_.terminations[reason]++; \
+            int len_ = st_.current_path_length < stat_max_path_length ? st_.current_path_length : stat_max_path_length; \
+            st_.path_lengths[len_]++; \
+        } while (0)
+    #define STAT_COST() (stats_local().traversal_cost())
+#else
+    #define STAT_RAY(type) ((void)0)
+    #define STAT_BVH_NODE() ((void)0)
+    #define STAT_PRIMITIVE(prim) ((void)0)
+    #define STAT_SCATTER(mat) ((void)0)
+    #define STAT_PATH_END(reason) ((void)0)
+    #define STAT_COST() (uint64_t(0))
+#endif
+
+#endif
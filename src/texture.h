@@ -6,6 +6,11 @@
 class texture {
     public:
         virtual color value(double u, double v, const point3& p) const = 0;
+
+        // footprint is the width of the shaded area in uv units, for textures that filter.
+        virtual color value(double u, double v, const point3& p, double footprint) const {
+            return value(u, v, p);
+        }
 };
 
 class solid_color : public texture {
@@ -42,6 +47,14 @@ class checker_texture : public texture {
                 return even->value(u, v, p);
         }
 
+        virtual color value(double u, double v, const point3& p, double footprint) const override {
+            auto sines = sin(10*p.x())*sin(10*p.y())*sin(10*p.z());
+            if (sines < 0)
+                return odd->value(u, v, p, footprint);
+            else
+                return even->value(u, v, p, footprint);
+        }
+
     public:
         shared_ptr<texture> odd;
         shared_ptr<texture> even;
@@ -0,0 +1,128 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+
+// Texels of image textures are stored in tiles of tile_texels x tile_texels rgb8
+// values. Every texture keeps its tiles in a file and the process wide texture_cache
+// holds a bounded number of them in memory, loading tiles the first time they are
+// touched and dropping the least recently used ones when full. Memory use therefore
+// doesn't grow with the number or size of textures in a scene.
+const int tile_texels = 8;
+const size_t tile_bytes = tile_texels * tile_texels * 3;
+
+using texture_tile = std::vector<uint8_t>;
+
+// Where a texture's tiles live: tile i is at byte i * tile_bytes of file.
+struct tile_source {
+    std::FILE* file = nullptr;
+    uint64_t id = 0; // never reused, so stale cache entries can't alias a new texture
+};
+
+class texture_cache {
+    public:
+        explicit texture_cache(size_t max_tiles = 4096) {
+            set_capacity(max_tiles);
+        }
+
+        static texture_cache& global() {
+            static texture_cache cache;
+            return cache;
+        }
+
+        static uint64_t new_id() {
+            static std::atomic<uint64_t> next{1};
+            return next++;
+        }
+
+        void set_capacity(size_t max_tiles) {
+            for (auto& s : shards) {
+                std::lock_guard<std::mutex> guard{s.m};
+                s.capacity = max_tiles / shard_count > 0 ? max_tiles / shard_count : 1;
+                s.evict();
+            }
+        }
+
+        // Returns tile index of src, reading it from disk on a miss. The tile stays valid
+        // for as long as the caller holds on to it, even if the cache drops it meanwhile.
+        std::shared_ptr<const texture_tile> get(const tile_source& src, uint32_t index) {
+            // consecutive lookups mostly land in the same tile, so remember the last one per thread
+            thread_local uint64_t last_id = 0;
+            thread_local uint32_t last_index = 0;
+            thread_local std::shared_ptr<const texture_tile> last_tile;
+            if (last_tile && last_id == src.id && last_index == index) return last_tile;
+
+            const uint64_t key = (src.id << 32) | index;
+            shard& s = shards[std::hash<uint64_t>()(key) % shard_count];
+
+            std::shared_ptr<const texture_tile> t;
+            {
+                std::lock_guard<std::mutex> guard{s.m};
+                auto it = s.entries.find(key);
+                if (it != s.entries.end()) {
+                    s.lru.splice(s.lru.begin(), s.lru, it->second.position);
+                    t = it->second.data;
+                }
+            }
+
+            if (!t) {
+                // read outside the lock, two threads missing on the same tile both read it
+                auto data = std::make_shared<texture_tile>(tile_bytes, 0);
+                if (!src.file || pread(fileno(src.file), data->data(), tile_bytes, static_cast<off_t>(index) * tile_bytes) != static_cast<ssize_t>(tile_bytes)) {
+                    std::fill(data->begin(), data->end(), 0);
+                }
+                t = data;
+                misses++;
+
+                std::lock_guard<std::mutex> guard{s.m};
+                if (s.entries.find(key) == s.entries.end()) {
+                    s.lru.push_front(key);
+                    s.entries[key] = entry{t, s.lru.begin()};
+                    s.evict();
+                }
+            }
+
+            last_id = src.id;
+            last_index = index;
+            last_tile = t;
+            return t;
+        }
+
+        uint64_t miss_count() const { return misses; }
+
+    private:
+        struct entry {
+            std::shared_ptr<const texture_tile> data;
+            std::list<uint64_t>::iterator position;
+        };
+
+        struct shard {
+            std::mutex m;
+            size_t capacity = 1;
+            std::unordered_map<uint64_t, entry> entries;
+            std::list<uint64_t> lru; // most recently used first
+
+            void evict() {
+                while (entries.size() > capacity) {
+                    entries.erase(lru.back());
+                    lru.pop_back();
+                }
+            }
+        };
+
+        static const int shard_count = 16;
+        shard shards[shard_count];
+        std::atomic<uint64_t> misses{0};
+};
+
+#endif
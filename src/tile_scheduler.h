@@ -0,0 +1,183 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#include "trace.h"
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Order in which the tiles of a frame are handed out.
+enum tile_order {
+    ORDER_SNAKE,        // rows from the top, alternating direction
+    ORDER_HILBERT,      // along a hilbert curve, keeps consecutive tiles close together
+    ORDER_CENTER_OUT    // closest to the image center first
+};
+
+struct tile {
+    int x0, y0; // inclusive
+    int x1, y1; // exclusive
+    int frame = 0;
+};
+
+inline unsigned default_thread_count() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+// Splits frames into tiles and hands them to a fixed set of workers.
+//
+// Every worker owns a deque holding a contiguous run of the ordered tiles. It takes
+// tiles from the front of its own deque and, once that is empty, steals from the back
+// of the others. The deques are guarded by their own mutex, which is almost never
+// contended because workers only meet when stealing.
+//
+// The scheduler has no global state, so it can be reused for any number of frames.
+class tile_scheduler {
+    public:
+        explicit tile_scheduler(unsigned workers = default_thread_count()) {
+            for (unsigned i = 0; i < std::max(workers, 1u); i++) {
+                queues.push_back(std::make_unique<worker_queue>());
+            }
+        }
+
+        unsigned worker_count() const { return static_cast<unsigned>(queues.size()); }
+
+        // Queues all tiles of a width x height frame, can be called while workers are running.
+        void add_frame(int width, int height, int tile_size, tile_order order, int frame = 0) {
+            std::vector<tile> tiles = make_tiles(width, height, tile_size, order, frame);
+
+            const size_t n = queues.size();
+            for (size_t q = 0; q < n; q++) {
+                const size_t begin = tiles.size() * q / n;
+                const size_t end = tiles.size() * (q + 1) / n;
+                std::lock_guard<std::mutex> guard{queues[q]->m};
+                queues[q]->tiles.insert(queues[q]->tiles.end(), tiles.begin() + begin, tiles.begin() + end);
+            }
+        }
+
+        // Drops all queued tiles.
+        void clear() {
+            for (auto& q : queues) {
+                std::lock_guard<std::mutex> guard{q->m};
+                q->tiles.clear();
+            }
+        }
+
+        // Fetches the next tile for worker, returns false once no tile is left anywhere.
+        bool next(unsigned worker, tile& t) {
+            const size_t n = queues.size();
+            worker %= n;
+            {
+                worker_queue& own = *queues[worker];
+                std::lock_guard<std::mutex> guard{own.m};
+                if (!own.tiles.empty()) {
+                    t = own.tiles.front();
+                    own.tiles.pop_front();
+                    return true;
+                }
+            }
+
+            for (size_t i = 1; i < n; i++) {
+                worker_queue& victim = *queues[(worker + i) % n];
+                std::lock_guard<std::mutex> guard{victim.m};
+                if (!victim.tiles.empty()) {
+                    t = victim.tiles.back();
+                    victim.tiles.pop_back();
+                    trace_instant("steal", "scheduler", t.frame, t.x0, t.y0);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        static std::vector<tile> make_tiles(int width, int height, int tile_size, tile_order order, int frame = 0) {
+            const int w_cnt = (width + tile_size - 1) / tile_size;
+            const int h_cnt = (height + tile_size - 1) / tile_size;
+
+            std::vector<std::pair<int, int>> cells;
+            cells.reserve(w_cnt * h_cnt);
+
+            switch (order) {
+                case ORDER_SNAKE:
+                    for (int y = h_cnt - 1, dir = 0; y >= 0; y--, dir = !dir) {
+                        for (int i = 0; i < w_cnt; i++) {
+                            cells.emplace_back(dir ? w_cnt - 1 - i : i, y);
+                        }
+                    }
+                    break;
+
+                case ORDER_HILBERT: {
+                    int n = 1;
+                    while (n < w_cnt || n < h_cnt) n *= 2;
+                    for (int d = 0; d < n * n; d++) {
+                        int x, y;
+                        hilbert_d2xy(n, d, x, y);
+                        if (x < w_cnt && y < h_cnt) cells.emplace_back(x, y);
+                    }
+                    break;
+                }
+
+                case ORDER_CENTER_OUT:
+                    for (int y = 0; y < h_cnt; y++)
+                    for (int x = 0; x < w_cnt; x++) {
+                        cells.emplace_back(x, y);
+                    }
+                    std::stable_sort(cells.begin(), cells.end(), [&](const std::pair<int, int>& a, const std::pair<int, int>& b) {
+                        // distances are compared in doubled coordinates to stay in integers
+                        auto dist = [&](const std::pair<int, int>& c) {
+                            int dx = 2 * c.first + 1 - w_cnt;
+                            int dy = 2 * c.second + 1 - h_cnt;
+                            return dx * dx + dy * dy;
+                        };
+                        return dist(a) < dist(b);
+                    });
+                    break;
+            }
+
+            std::vector<tile> tiles;
+            tiles.reserve(cells.size());
+            for (const auto& c : cells) {
+                tile t;
+                t.x0 = c.first * tile_size;
+                t.y0 = c.second * tile_size;
+                t.x1 = std::min(t.x0 + tile_size, width);
+                t.y1 = std::min(t.y0 + tile_size, height);
+                t.frame = frame;
+                tiles.push_back(t);
+            }
+            return tiles;
+        }
+
+    private:
+        struct worker_queue {
+            std::mutex m;
+            std::deque<tile> tiles;
+        };
+
+        // Position of the d-th cell along a hilbert curve filling an n x n grid (n a power of two).
+        static void hilbert_d2xy(int n, int d, int& x, int& y) {
+            x = y = 0;
+            for (int s = 1; s < n; s *= 2) {
+                int rx = 1 & (d / 2);
+                int ry = 1 & (d ^ rx);
+                if (ry == 0) {
+                    if (rx == 1) {
+                        x = s - 1 - x;
+                        y = s - 1 - y;
+                    }
+                    std::swap(x, y);
+                }
+                x += s * rx;
+                y += s * ry;
+                d /= 4;
+            }
+        }
+
+        std::vector<std::unique_ptr<worker_queue>> queues;
+};
+
+#endif
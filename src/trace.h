@@ -0,0 +1,167 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Timeline tracing in the Chrome trace event format, viewable in chrome://tracing or
+// ui.perfetto.dev. Tracing is off until trace_begin is called; a disabled trace_span
+// costs one relaxed atomic load.
+//
+// Every thread appends to its own buffer, so recording never takes a lock. Buffers
+// outlive their threads and are written out by trace_end, which must only be called
+// while no other thread is still recording.
+
+struct trace_event {
+    const char* name;
+    const char* category;
+    char phase;         // 'X' complete span, 'i' instant
+    int64_t start_us;
+    int64_t duration_us;
+    int frame, x, y;    // shown as args when >= 0
+};
+
+struct trace_buffer {
+    int tid;
+    std::string thread_name;
+    std::vector<trace_event> events;
+};
+
+struct trace_state {
+    std::atomic<bool> enabled{false};
+    std::string path;
+    std::chrono::steady_clock::time_point start;
+
+    std::mutex m;
+    std::vector<std::shared_ptr<trace_buffer>> buffers;
+    int next_tid = 0;
+};
+
+inline trace_state& tracer() {
+    static trace_state state;
+    return state;
+}
+
+inline bool trace_enabled() {
+    return tracer().enabled.load(std::memory_order_relaxed);
+}
+
+inline int64_t trace_now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tracer().start).count();
+}
+
+inline trace_buffer& trace_local() {
+    thread_local std::shared_ptr<trace_buffer> local;
+    if (!local) {
+        local = std::make_shared<trace_buffer>();
+        std::lock_guard<std::mutex> guard{tracer().m};
+        local->tid = tracer().next_tid++;
+        tracer().buffers.push_back(local);
+    }
+    return *local;
+}
+
+// Names the calling thread in the trace viewer. Threads given the name of an earlier,
+// finished thread share its track, so per-pass worker threads line up.
+inline void trace_thread_name(const std::string& name) {
+    if (!trace_enabled()) return;
+    trace_buffer& local = trace_local();
+    std::lock_guard<std::mutex> guard{tracer().m};
+    for (const auto& b : tracer().buffers) {
+        if (b.get() != &local && b->thread_name == name) {
+            local.tid = b->tid;
+            break;
+        }
+    }
+    local.thread_name = name;
+}
+
+inline void trace_instant(const char* name, const char* category, int frame = -1, int x = -1, int y = -1) {
+    if (!trace_enabled()) return;
+    trace_local().events.push_back(trace_event{name, category, 'i', trace_now_us(), 0, frame, x, y});
+}
+
+// Records the time between its construction and destruction as one span.
+class trace_span {
+    public:
+        trace_span(const char* n, const char* cat, int f = -1, int tx = -1, int ty = -1)
+            : name(n), category(cat), frame(f), x(tx), y(ty), active(trace_enabled())
+        {
+            if (active) start = trace_now_us();
+        }
+
+        ~trace_span() {
+            if (!active) return;
+            trace_local().events.push_back(trace_event{name, category, 'X', start, trace_now_us() - start, frame, x, y});
+        }
+
+        trace_span(const trace_span&) = delete;
+        trace_span& operator=(const trace_span&) = delete;
+
+    private:
+        const char* name;
+        const char* category;
+        int frame, x, y;
+        bool active;
+        int64_t start = 0;
+};
+
+// Starts recording, the trace is written to path by trace_end.
+inline void trace_begin(const std::string& path) {
+    trace_state& t = tracer();
+    t.path = path;
+    t.start = std::chrono::steady_clock::now();
+    t.enabled = true;
+}
+
+inline bool trace_end() {
+    trace_state& t = tracer();
+    if (!t.enabled) return true;
+    t.enabled = false;
+
+    std::FILE* f = std::fopen(t.path.c_str(), "w");
+    if (!f) return false;
+
+    std::lock_guard<std::mutex> guard{t.m};
+    std::fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    auto separator = [&] {
+        if (!first) std::fprintf(f, ",\n");
+        first = false;
+    };
+
+    std::vector<int> named;
+    for (const auto& b : t.buffers) {
+        if (!b->thread_name.empty() && std::find(named.begin(), named.end(), b->tid) == named.end()) {
+            named.push_back(b->tid);
+            separator();
+            std::fprintf(f, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                b->tid, b->thread_name.c_str());
+        }
+        for (const auto& e : b->events) {
+            separator();
+            std::fprintf(f, "{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"%c\", \"pid\": 1, \"tid\": %d, \"ts\": %lld",
+                e.name, e.category, e.phase, b->tid, static_cast<long long>(e.start_us));
+            if (e.phase == 'X') std::fprintf(f, ", \"dur\": %lld", static_cast<long long>(e.duration_us));
+            else std::fprintf(f, ", \"s\": \"t\"");
+
+            std::fprintf(f, ", \"args\": {");
+            const char* sep = "";
+            if (e.frame >= 0) { std::fprintf(f, "%s\"frame\": %d", sep, e.frame); sep = ", "; }
+            if (e.x >= 0) { std::fprintf(f, "%s\"x\": %d", sep, e.x); sep = ", "; }
+            if (e.y >= 0) { std::fprintf(f, "%s\"y\": %d", sep, e.y); sep = ", "; }
+            std::fprintf(f, "}}");
+        }
+        b->events.clear();
+    }
+    std::fprintf(f, "\n]}\n");
+    return std::fclose(f) == 0;
+}
+
+#endif